@@ -1,38 +1,111 @@
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stop_token>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <cwctype>
 #include <objidl.h> 
+#include <shellapi.h>
 #include <shlobj.h>
+#include <shlwapi.h>
 #include <windows.h>
+#include <dbt.h>
+#include <psapi.h>
+#include <tlhelp32.h>
 #include <iostream>
 
 #ifndef PROPID
 typedef ULONG PROPID;
 #endif
 
+#include <d2d1.h>
+#include <dwrite.h>
 #include <gdiplus.h>
+#include <wrl/client.h>
 #include <xinput.h>
+#include "audio_core/sink/sink_details.h"
 #include "common/settings.h"
 #include "core/core.h"
 #include "core/cpu_manager.h"
+#include "core/crypto/key_manager.h"
+#include "core/file_sys/card_image.h"
+#include "core/file_sys/content_archive.h"
+#include "core/file_sys/nca_metadata.h"
+#include "core/file_sys/partition_filesystem.h"
 #include "core/file_sys/registered_cache.h"
+#include "core/file_sys/romfs.h"
+#include "core/file_sys/submission_package.h"
+#include "core/file_sys/vfs/vfs_offset.h"
 #include "core/file_sys/vfs/vfs_real.h"
+#include "core/file_sys/vfs/vfs_vector.h"
 #include "core/frontend/emu_window.h"
 #include "core/frontend/graphics_context.h"
+#include "core/hardware_properties.h"
+#include "core/hle/service/filesystem/filesystem.h"
 #include "core/hle/service/am/applet_manager.h"
 #include "core/loader/loader.h"
+#include "hid_core/hid_core.h"
+#include "input_common/drivers/virtual_gamepad.h"
+#include "input_common/main.h"
 #include "video_core/gpu.h"
+#include "video_core/rasterizer_interface.h"
+#include "video_core/renderer_base.h"
+#include "video_core/shader_notify.h"
+
+#include <mbedtls/aes.h>
+#include <mbedtls/sha256.h>
+#include <zstd.h>
 
 using namespace Gdiplus;
 namespace fs = std::filesystem;
 
 // --- Constants ---
 #define MAX_CONTROLLERS 4
+#define WM_APP_SCAN_BATCH (WM_APP + 1)
+#define WM_APP_SCAN_DONE (WM_APP + 2)
+#define WM_APP_LIBRARY_CHANGE (WM_APP + 3)
+#define WM_APP_METADATA (WM_APP + 4)
+#define WM_APP_METADATA_IDLE (WM_APP + 5)
+#define WM_APP_BOOT_STAGE (WM_APP + 6)
+#define WM_APP_BOOT_DONE (WM_APP + 7)
+#define WM_APP_BOOT_PROGRESS (WM_APP + 8)
+#define WM_APP_MEMORY_TRIM (WM_APP + 9)
+#define WM_APP_INSTALL_DONE (WM_APP + 10)
+#define WM_APP_OVERLAY_SAMPLE (WM_APP + 11)
+#define WM_APP_OVERLAY_TOGGLE (WM_APP + 12)
+#define WM_APP_PERF_DUMP (WM_APP + 13)
+#define WM_APP_STOP_TITLE (WM_APP + 14)
+#define WM_APP_STOP_DONE (WM_APP + 15)
+#define BOOT_REFRESH_TIMER 1
+#define GAME_ORDER_TIMER 2
+#define INSTALL_REFRESH_TIMER 3
+#define BENCHMARK_TIMER 4
+#define PLACEMENT_TIMER 5
 const int INPUT_DEADZONE = 8000;
 const Color COLOR_BG(255, 30, 30, 30);
 const Color COLOR_ACCENT(255, 255, 140, 0); 
@@ -49,20 +122,39 @@ const Color COLOR_TAB_INACTIVE(255, 70, 70, 70);
 struct Game {
     std::wstring name;
     std::filesystem::path path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t title_id = 0; // 0 until the metadata cache knows the title
+    std::wstring title;    // localized application name from the NACP
+    int64_t last_played = 0;
 };
 
-enum class AppState { GameList, Settings, Running };
+enum class AppState { GameList, Settings, Profile, Booting, Running, Stopping };
 enum class SettingsTab { General, System, Graphics, Audio, Network };
+enum class UiRendererKind { GdiPlus, Direct2D };
+enum class ThreadPlacement { Off, Soft, Pinned, Count };
+enum class MemoryCategory { GuestRam, UiAssets, RomCache, Count };
 
 // --- Forward Declarations ---
 static void ScanGames();
-static void RenderUI(HDC hdc, int width, int height);
+class UiCanvas;
+static void RenderUI(UiCanvas& canvas, int width, int height);
 static void HandleInput(HWND hwnd);
 static void StartGame(HWND hwnd, const Game& game);
 static void InstallFiles(HWND hwnd, const std::wstring& title, const std::filesystem::path& subPath);
 static void SaveSettings();
 static void LoadSettings();
-[[maybe_unused]] static void EnforceMemoryLimit();
+static void StartWarmup(bool contentChanged = false);
+static void RebuildFirmwareManifest();
+static void EnforceMemoryLimit();
+static void ConfigureGuestInput();
+static void StartInputThread();
+static void StartPerfSampler();
+static void StartThreadPlacement(HWND hwnd);
+static void FinishBenchmark(HWND hwnd, const wchar_t* error);
+static void ScheduleGameOrderRebuild();
+static void ChargeMemory(MemoryCategory category, int64_t bytes);
+static void ReleaseMemory(MemoryCategory category, int64_t bytes);
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
 // --- Global State ---
@@ -70,14 +162,19 @@ bool g_IsEditingSetting = false;
 AppState g_AppState = AppState::GameList;
 SettingsTab g_CurrentTab = SettingsTab::General;
 std::atomic<bool> g_IsInstalling = false;
-std::wstring g_InstallStatus = L"";
 std::vector<std::filesystem::path> g_UserGamePaths;
 std::vector<Game> g_Games;
+std::unordered_set<std::wstring> g_GamePaths; // mirrors g_Games, rejects duplicates from scan/watch races
 int g_SelectedGameIndex = 0;
 int g_SelectedSettingIndex = 0; 
 ULONGLONG g_NextInputTime = 0;
 WORD g_LastInputMask = 0;
 ULONG_PTR g_gdiplusToken;
+HWND g_MainWindow = NULL;
+bool g_PrewarmShaders = true;
+UiRendererKind g_UiRenderer = UiRendererKind::Direct2D;
+int g_MenuPollRate = 120; // Hz, XInput polling while a menu is shown
+ThreadPlacement g_ThreadPlacement = ThreadPlacement::Soft;
 
 // --- Emu Window Classes ---
 class DummyContext : public Core::Frontend::GraphicsContext {
@@ -104,9 +201,18 @@ private:
 
 std::unique_ptr<XboxEmuWindow> g_EmuWindow;
 std::unique_ptr<Core::System> g_System;
+std::unique_ptr<InputCommon::InputSubsystem> g_InputSubsystem; // created by WarmSystem()
 
 // --- Helper Functions ---
 
+// Names show up in debuggers and let Thread Placement find our own threads.
+// SetThreadDescription is looked up at runtime like its Get counterpart.
+static void SetCurrentThreadName(const wchar_t* name) {
+    using SetThreadDescriptionFn = HRESULT(WINAPI*)(HANDLE, PCWSTR);
+    static auto setDescription = reinterpret_cast<SetThreadDescriptionFn>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"));
+    if (setDescription) setDescription(GetCurrentThread(), name);
+}
+
 static std::wstring Trim(const std::wstring& s) {
     if (s.empty()) return s;
     size_t start = 0;
@@ -119,8 +225,9 @@ static std::wstring Trim(const std::wstring& s) {
 // ---------------------------------------------------------
 // CRITICAL: XBOX PATH FIX
 // This gets the "LocalState" folder which is the ONLY writable place.
+// Resolved once; the folder layout is created on the first call only.
 // ---------------------------------------------------------
-static std::filesystem::path GetUserDirectory() {
+static std::filesystem::path ResolveUserDirectory() {
     wchar_t buffer[32767];
     if (GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, 32767)) {
         std::filesystem::path p(buffer);
@@ -143,398 +250,5134 @@ static std::filesystem::path GetUserDirectory() {
     return std::filesystem::path(path).parent_path() / "user";
 }
 
+static const std::filesystem::path& GetUserDirectory() {
+    static const std::filesystem::path dir = ResolveUserDirectory();
+    return dir;
+}
+
+static std::wstring Utf8ToWide(const std::string& s) {
+    if (s.empty()) return L"";
+    int len = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), NULL, 0);
+    std::wstring out(len, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), out.data(), len);
+    return out;
+}
+
+static std::string WideToUtf8(const std::wstring& s) {
+    if (s.empty()) return "";
+    int len = WideCharToMultiByte(CP_UTF8, 0, s.data(), (int)s.size(), NULL, 0, NULL, NULL);
+    std::string out(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, s.data(), (int)s.size(), out.data(), len, NULL, NULL);
+    return out;
+}
+
+static const std::wstring& GetDisplayName(const Game& game) {
+    return game.title.empty() ? game.name : game.title;
+}
+
+static bool IsVolumeMounted(const std::filesystem::path& p) {
+    std::wstring drive = p.root_name().wstring();
+    if (drive.size() != 2 || drive[1] != L':') return true; // UNC and relative paths can't be probed cheaply
+    wchar_t letter = (wchar_t)std::towupper(drive[0]);
+    if (letter < L'A' || letter > L'Z') return true;
+    return (GetLogicalDrives() & (1u << (letter - L'A'))) != 0;
+}
+
 static std::filesystem::path GetConfigPath() {
     // Save config inside the user directory so it's portable-ish
     return GetUserDirectory() / "config.ini";
 }
 
-// --- Implementation ---
+// --- Tracing ---
+// Scoped spans recorded into a per-thread ring and written as a Chrome trace
+// (chrome://tracing, ui.perfetto.dev) to user/trace/<time>.json on exit. Only
+// built with CITRON_ENABLE_TRACING; otherwise every macro expands to nothing.
+// Span names must be string literals or otherwise outlive the process.
+#ifdef CITRON_ENABLE_TRACING
+const size_t TRACE_RING_EVENTS = 16384; // per thread; the oldest are overwritten
+
+struct TraceEvent {
+    const char* name;
+    int64_t beginUs;
+    int64_t durUs;
+};
+
+struct TraceRing {
+    DWORD tid = GetCurrentThreadId();
+    const char* threadName = nullptr;
+    std::atomic<size_t> written = 0; // released after each event
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+// Rings are owned here so threads that exited still show up in the file.
+std::mutex g_TraceMutex;
+std::vector<std::unique_ptr<TraceRing>> g_TraceRings;
+
+static int64_t TraceNowUs() {
+    static const LARGE_INTEGER freq = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart * 1000000 / freq.QuadPart;
+}
+
+static TraceRing& GetTraceRing() {
+    thread_local TraceRing* ring = [] {
+        auto owned = std::make_unique<TraceRing>();
+        TraceRing* raw = owned.get();
+        std::lock_guard lock(g_TraceMutex);
+        g_TraceRings.push_back(std::move(owned));
+        return raw;
+    }();
+    return *ring;
+}
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name), begin_(name ? TraceNowUs() : 0) {}
+    ~TraceScope() { Next(nullptr); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    // Closes the current span and opens `name` (none if null) back to back.
+    void Next(const char* name) {
+        int64_t now = TraceNowUs();
+        if (name_) {
+            TraceRing& ring = GetTraceRing();
+            size_t n = ring.written.load(std::memory_order_relaxed);
+            ring.events[n % TRACE_RING_EVENTS] = {name_, begin_, now - begin_};
+            ring.written.store(n + 1, std::memory_order_release);
+        }
+        name_ = name;
+        begin_ = now;
+    }
+
+private:
+    const char* name_;
+    int64_t begin_;
+};
+
+static void WriteTraceFile() {
+    std::string json = "{\"traceEvents\":[\n";
+    bool first = true;
+    auto append = [&](const std::string& event) {
+        if (!first) json += ",\n";
+        json += event;
+        first = false;
+    };
+    {
+        std::lock_guard lock(g_TraceMutex);
+        for (const auto& ring : g_TraceRings) {
+            if (ring->threadName)
+                append(fmt::format("{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", ring->tid, ring->threadName));
+            size_t n = ring->written.load(std::memory_order_acquire);
+            for (size_t i = n > TRACE_RING_EVENTS ? n - TRACE_RING_EVENTS : 0; i < n; ++i) {
+                const TraceEvent& e = ring->events[i % TRACE_RING_EVENTS];
+                append(fmt::format("{{\"ph\":\"X\",\"name\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{}}}", e.name, ring->tid, e.beginUs, e.durUs));
+            }
+        }
+    }
+    json += "\n]}\n";
+
+    SYSTEMTIME st;
+    GetLocalTime(&st);
+    auto dir = GetUserDirectory() / "trace";
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    std::ofstream out(dir / fmt::format("{:04}{:02}{:02}-{:02}{:02}{:02}.json", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond),
+                      std::ios::binary | std::ios::trunc);
+    out << json;
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_SCOPE_ONCE(name) \
+    static std::atomic<bool> TRACE_CONCAT(traceOnce_, __LINE__) = false; \
+    TraceScope TRACE_CONCAT(traceScope_, __LINE__)(TRACE_CONCAT(traceOnce_, __LINE__).exchange(true) ? nullptr : (name))
+#define TRACE_NAMED_SCOPE(var, name) TraceScope var(name)
+#define TRACE_NEXT(var, name) var.Next(name)
+#define TRACE_THREAD_NAME(name) (GetTraceRing().threadName = (name))
+#define TRACE_WRITE() WriteTraceFile()
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ONCE(name) ((void)0)
+#define TRACE_NAMED_SCOPE(var, name) ((void)0)
+#define TRACE_NEXT(var, name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_WRITE() ((void)0)
+#endif
+
+// --- Implementation ---
+
+// --- Library Index ---
+// Snapshot of every directory below the search roots, saved next to config.ini.
+// A directory whose last-write time still matches its record is trusted as-is,
+// so an unchanged tree costs one stat per folder instead of a full enumeration.
+struct LibraryGameRecord {
+    std::wstring name; // package file name directly inside the directory
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+struct LibraryDirRecord {
+    int64_t mtime = 0;
+    std::vector<LibraryGameRecord> games;
+    std::vector<std::wstring> subdirs; // child directory names
+};
+using LibraryIndex = std::unordered_map<std::wstring, LibraryDirRecord>;
+
+static const uint32_t LIBRARY_INDEX_MAGIC = 0x58444C43; // "CLDX"
+static const uint32_t LIBRARY_INDEX_VERSION = 3;
+std::mutex g_LibraryIndexMutex; // guards g_LibraryIndex, scan workers read and merge concurrently
+LibraryIndex g_LibraryIndex;
+bool g_LibraryIndexLoaded = false;
+
+static std::filesystem::path GetLibraryIndexPath() {
+    return GetUserDirectory() / "library.idx";
+}
+
+static bool IsGameFile(const std::filesystem::path& p) {
+    std::string ext = p.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".nsp" || ext == ".xci" || ext == ".nsz" || ext == ".xcz";
+}
+
+// FAT32 never bumps a directory's write time when entries change, so the index
+// can only be trusted on volumes that do (NTFS, exFAT, ReFS).
+static bool VolumeTracksDirectoryTimes(const std::filesystem::path& root) {
+    std::wstring volume = root.root_path().wstring();
+    wchar_t fsName[MAX_PATH + 1] = {};
+    if (!GetVolumeInformationW(volume.c_str(), NULL, 0, NULL, NULL, NULL, fsName, MAX_PATH + 1)) return false;
+    return _wcsicmp(fsName, L"FAT") != 0 && _wcsicmp(fsName, L"FAT32") != 0;
+}
+
+static void WriteIndexString(std::ofstream& out, const std::wstring& str) {
+    uint32_t len = (uint32_t)str.size();
+    out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.write(reinterpret_cast<const char*>(str.data()), len * sizeof(wchar_t));
+}
+
+static bool ReadIndexString(std::ifstream& in, std::wstring& str) {
+    uint32_t len = 0;
+    if (!in.read(reinterpret_cast<char*>(&len), sizeof(len)) || len > 32767) return false; // longest Win32 path
+    str.resize(len);
+    return (bool)in.read(reinterpret_cast<char*>(str.data()), len * sizeof(wchar_t));
+}
+
+static void LoadLibraryIndex() {
+    std::lock_guard lock(g_LibraryIndexMutex);
+    g_LibraryIndexLoaded = true;
+    g_LibraryIndex.clear();
+
+    std::ifstream in(GetLibraryIndexPath(), std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return;
+    const uint64_t fileSize = (uint64_t)in.tellg();
+    in.seekg(0);
+    // Counts come from disk: each must fit in what's left of the file at the
+    // smallest record size, or the file is corrupt and resize() could throw.
+    auto fits = [&](uint32_t n, uint64_t minRecord) {
+        auto pos = in.tellg();
+        return pos >= 0 && (uint64_t)n * minRecord <= fileSize - (uint64_t)pos;
+    };
+
+    uint32_t magic = 0, version = 0, count = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || magic != LIBRARY_INDEX_MAGIC || version != LIBRARY_INDEX_VERSION) return;
+    if (!fits(count, 4 + 8 + 4 + 4)) return; // name length, mtime, both counts
+
+    LibraryIndex index;
+    for (uint32_t i = 0; i < count; ++i) {
+        std::wstring dir;
+        LibraryDirRecord rec;
+        uint32_t numGames = 0, numSubdirs = 0;
+        if (!ReadIndexString(in, dir)) return;
+        in.read(reinterpret_cast<char*>(&rec.mtime), sizeof(rec.mtime));
+        in.read(reinterpret_cast<char*>(&numGames), sizeof(numGames));
+        if (!in || !fits(numGames, 4 + 8 + 8)) return;
+        rec.games.resize(numGames);
+        for (auto& g : rec.games) {
+            if (!ReadIndexString(in, g.name)) return;
+            in.read(reinterpret_cast<char*>(&g.size), sizeof(g.size));
+            in.read(reinterpret_cast<char*>(&g.mtime), sizeof(g.mtime));
+        }
+        in.read(reinterpret_cast<char*>(&numSubdirs), sizeof(numSubdirs));
+        if (!in || !fits(numSubdirs, 4)) return;
+        rec.subdirs.resize(numSubdirs);
+        for (auto& d : rec.subdirs) if (!ReadIndexString(in, d)) return;
+        index.emplace(std::move(dir), std::move(rec));
+    }
+    // Only adopt the index once it parsed completely; a truncated file means a full walk.
+    g_LibraryIndex = std::move(index);
+}
+
+static void SaveLibraryIndex() {
+    auto path = GetLibraryIndexPath();
+    auto tmp = path; tmp += ".tmp";
+    std::lock_guard lock(g_LibraryIndexMutex);
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return;
+        uint32_t count = (uint32_t)g_LibraryIndex.size();
+        out.write(reinterpret_cast<const char*>(&LIBRARY_INDEX_MAGIC), sizeof(LIBRARY_INDEX_MAGIC));
+        out.write(reinterpret_cast<const char*>(&LIBRARY_INDEX_VERSION), sizeof(LIBRARY_INDEX_VERSION));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const auto& [dir, rec] : g_LibraryIndex) {
+            uint32_t numGames = (uint32_t)rec.games.size(), numSubdirs = (uint32_t)rec.subdirs.size();
+            WriteIndexString(out, dir);
+            out.write(reinterpret_cast<const char*>(&rec.mtime), sizeof(rec.mtime));
+            out.write(reinterpret_cast<const char*>(&numGames), sizeof(numGames));
+            for (const auto& g : rec.games) {
+                WriteIndexString(out, g.name);
+                out.write(reinterpret_cast<const char*>(&g.size), sizeof(g.size));
+                out.write(reinterpret_cast<const char*>(&g.mtime), sizeof(g.mtime));
+            }
+            out.write(reinterpret_cast<const char*>(&numSubdirs), sizeof(numSubdirs));
+            for (const auto& d : rec.subdirs) WriteIndexString(out, d);
+        }
+        if (!out) return;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+}
+
+// --- Library Scan ---
+// Every search root gets its own worker so a sleeping USB drive only delays its
+// own titles. Workers hand found games to the UI thread in batches through
+// WM_APP_SCAN_BATCH; batches from a superseded scan generation are dropped.
+const size_t SCAN_BATCH_SIZE = 64;
+const ULONGLONG SCAN_BATCH_INTERVAL_MS = 100;
+
+struct ScanBatch {
+    uint32_t generation;
+    std::vector<Game> games;
+};
+
+struct ScanContext {
+    std::filesystem::path root;
+    uint32_t generation = 0;
+    bool trustIndex = false;
+    LibraryIndex fresh;
+    std::vector<Game> pending;
+    ULONGLONG lastFlush = 0;
+};
+
+std::atomic<uint32_t> g_ScanGeneration = 0;
+std::atomic<int> g_ScanWorkersActive = 0;
+
+static bool IsUnderRoot(const std::wstring& path, const std::wstring& root) {
+    if (path.size() < root.size() || _wcsnicmp(path.c_str(), root.c_str(), root.size()) != 0) return false;
+    if (path.size() == root.size()) return true;
+    wchar_t last = root.back(), next = path[root.size()];
+    return last == L'\\' || last == L'/' || next == L'\\' || next == L'/';
+}
+
+static bool LookupLibraryRecord(const std::wstring& dir, LibraryDirRecord& rec) {
+    std::lock_guard lock(g_LibraryIndexMutex);
+    auto it = g_LibraryIndex.find(dir);
+    if (it == g_LibraryIndex.end()) return false;
+    rec = it->second;
+    return true;
+}
+
+// Replaces everything the index knows about one root with a fresh walk of it.
+static void MergeLibraryIndex(const std::filesystem::path& root, LibraryIndex&& fresh) {
+    std::wstring prefix = root.wstring();
+    std::lock_guard lock(g_LibraryIndexMutex);
+    for (auto it = g_LibraryIndex.begin(); it != g_LibraryIndex.end();) {
+        if (IsUnderRoot(it->first, prefix)) it = g_LibraryIndex.erase(it);
+        else ++it;
+    }
+    for (auto& [dir, rec] : fresh) g_LibraryIndex[dir] = std::move(rec);
+}
+
+static void FlushScanBatch(ScanContext& ctx) {
+    ctx.lastFlush = GetTickCount64();
+    if (ctx.pending.empty()) return;
+    auto* batch = new ScanBatch{ctx.generation, std::move(ctx.pending)};
+    ctx.pending.clear();
+    if (!PostMessageW(g_MainWindow, WM_APP_SCAN_BATCH, 0, reinterpret_cast<LPARAM>(batch))) delete batch;
+}
+
+// Walks one directory, reusing the cached listing when its mtime is unchanged
+// and only enumerating directories that were touched since the last scan.
+// Unreadable entries are skipped individually instead of aborting the root.
+static void ScanDirectory(const std::filesystem::path& dir, ScanContext& ctx) {
+    if (ctx.generation != g_ScanGeneration) return;
+
+    std::error_code ec;
+    auto stamp = fs::last_write_time(dir, ec).time_since_epoch().count();
+    if (ec) return;
+
+    LibraryDirRecord rec;
+    if (!ctx.trustIndex || !LookupLibraryRecord(dir.wstring(), rec) || rec.mtime != stamp) {
+        rec = {};
+        rec.mtime = stamp;
+        fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            std::error_code entryEc;
+            const auto& entry = *it;
+            if (entry.is_directory(entryEc) && !entry.is_symlink(entryEc)) {
+                rec.subdirs.push_back(entry.path().filename().wstring());
+            } else if (entry.is_regular_file(entryEc) && IsGameFile(entry.path())) {
+                // Size and time come from the cached FindNextFile data, no extra I/O.
+                LibraryGameRecord game;
+                game.name = entry.path().filename().wstring();
+                game.size = entry.file_size(entryEc);
+                game.mtime = entry.last_write_time(entryEc).time_since_epoch().count();
+                rec.games.push_back(std::move(game));
+            }
+        }
+        // An interrupted listing is kept for this session but walked again next time.
+        if (ec) rec.mtime = 0;
+    }
+
+    for (const auto& g : rec.games) ctx.pending.push_back({g.name, dir / g.name, g.size, g.mtime});
+    if (ctx.pending.size() >= SCAN_BATCH_SIZE || GetTickCount64() - ctx.lastFlush >= SCAN_BATCH_INTERVAL_MS) FlushScanBatch(ctx);
+
+    for (const auto& sub : rec.subdirs) ScanDirectory(dir / sub, ctx);
+    ctx.fresh[dir.wstring()] = std::move(rec);
+}
+
+static void ScanRootThread(std::filesystem::path root, uint32_t generation) {
+    TRACE_THREAD_NAME("LibraryScan");
+    TRACE_SCOPE("ScanRootThread");
+    ScanContext ctx;
+    ctx.root = root;
+    ctx.generation = generation;
+    ctx.lastFlush = GetTickCount64();
+    try {
+        std::error_code ec;
+        if (fs::is_directory(root, ec)) {
+            ctx.trustIndex = VolumeTracksDirectoryTimes(root);
+            ScanDirectory(root, ctx);
+        }
+        FlushScanBatch(ctx);
+        // A cancelled walk is incomplete, so it must not overwrite the previous records.
+        if (generation == g_ScanGeneration) MergeLibraryIndex(root, std::move(ctx.fresh));
+    } catch (...) {}
+
+    if (--g_ScanWorkersActive == 0) {
+        SaveLibraryIndex();
+        PostMessageW(g_MainWindow, WM_APP_SCAN_DONE, 0, 0);
+    }
+}
+
+// --- Library Watcher ---
+// One thread keeps an overlapped ReadDirectoryChangesW armed on every search
+// root. File adds/removes become WM_APP_LIBRARY_CHANGE messages; new folders
+// are walked through the normal scan path, and a notification overflow falls
+// back to rescanning just that root. Each root's handle is registered for
+// device notifications; when its drive is about to be removed the UI thread
+// asks the watcher to close it, so the open handle doesn't veto the removal.
+// A game file that appears or changes is only reported once it has gone
+// WATCH_SETTLE_MS without a change and no writer holds it open, so a copy in
+// progress isn't read as a broken title; a changed file is re-read.
+const ULONGLONG WATCH_SETTLE_MS = 2000;
+
+struct LibraryChange {
+    uint32_t generation;
+    std::vector<Game> added;
+    std::vector<std::filesystem::path> removed; // files or folders, everything below goes
+};
+
+struct WatchedRoot {
+    std::filesystem::path path;
+    HANDLE dir = INVALID_HANDLE_VALUE;
+    HDEVNOTIFY notify = NULL;
+    OVERLAPPED ov = {};
+    alignas(DWORD) uint8_t buffer[64 * 1024];
+};
+
+struct WatcherControl {
+    HANDLE stop = CreateEventW(NULL, TRUE, FALSE, NULL);
+    HANDLE release = CreateEventW(NULL, FALSE, FALSE, NULL);  // releaseDir is set
+    HANDLE released = CreateEventW(NULL, FALSE, FALSE, NULL); // releaseDir was closed (or isn't ours)
+    std::atomic<HANDLE> releaseDir = NULL;
+    ~WatcherControl() {
+        for (HANDLE h : {stop, release, released}) if (h) CloseHandle(h);
+    }
+};
+
+std::shared_ptr<WatcherControl> g_Watcher;
+
+static bool ArmWatch(WatchedRoot& w) {
+    ResetEvent(w.ov.hEvent);
+    return ReadDirectoryChangesW(w.dir, w.buffer, sizeof(w.buffer), TRUE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &w.ov, NULL) != FALSE;
+}
+
+static void PostLibraryChange(LibraryChange*& change) {
+    if (!change) return;
+    if (!PostMessageW(g_MainWindow, WM_APP_LIBRARY_CHANGE, 0, reinterpret_cast<LPARAM>(change))) delete change;
+    change = nullptr;
+}
+
+static void RescanRoot(const std::filesystem::path& root, uint32_t generation) {
+    auto* change = new LibraryChange{generation, {}, {root}};
+    PostLibraryChange(change);
+    ++g_ScanWorkersActive;
+    std::thread(ScanRootThread, root, generation).detach();
+}
+
+// Game files seen changing, with the tick of their last change.
+using SettlingFiles = std::unordered_map<std::wstring, ULONGLONG>;
+
+static void DispatchWatchEvents(WatchedRoot& w, uint32_t generation, SettlingFiles& settling) {
+    LibraryChange* change = nullptr;
+    auto* info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(w.buffer);
+    while (true) {
+        std::wstring name(info->FileName, info->FileNameLength / sizeof(wchar_t));
+        std::filesystem::path full = w.path / name;
+        switch (info->Action) {
+        case FILE_ACTION_REMOVED:
+        case FILE_ACTION_RENAMED_OLD_NAME:
+            if (!change) change = new LibraryChange{generation};
+            change->removed.push_back(full);
+            settling.erase(full.wstring());
+            break;
+        case FILE_ACTION_ADDED:
+        case FILE_ACTION_RENAMED_NEW_NAME: {
+            std::error_code ec;
+            if (fs::is_directory(full, ec)) {
+                // Removals queued so far must reach the UI before the folder's games do.
+                PostLibraryChange(change);
+                ScanContext ctx;
+                ctx.root = full;
+                ctx.generation = generation;
+                ctx.lastFlush = GetTickCount64();
+                try { ScanDirectory(full, ctx); } catch (...) {}
+                FlushScanBatch(ctx);
+            } else if (IsGameFile(full)) {
+                settling[full.wstring()] = GetTickCount64();
+            }
+            break;
+        }
+        case FILE_ACTION_MODIFIED:
+            if (IsGameFile(full)) settling[full.wstring()] = GetTickCount64();
+            break;
+        }
+        if (info->NextEntryOffset == 0) break;
+        info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(reinterpret_cast<uint8_t*>(info) + info->NextEntryOffset);
+    }
+    PostLibraryChange(change);
+}
+
+// Reports the settling files that are quiet and closed by their writer, and
+// returns how long the watcher may wait before the next one is due.
+static DWORD FlushSettledFiles(SettlingFiles& settling, uint32_t generation) {
+    LibraryChange* change = nullptr;
+    ULONGLONG now = GetTickCount64();
+    DWORD wait = INFINITE;
+    for (auto it = settling.begin(); it != settling.end();) {
+        if (now - it->second < WATCH_SETTLE_MS) {
+            wait = std::min(wait, (DWORD)(WATCH_SETTLE_MS - (now - it->second)));
+            ++it;
+            continue;
+        }
+        // Refusing to share writes fails while the copy still has the file open.
+        HANDLE h = CreateFileW(it->first.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+        if (h == INVALID_HANDLE_VALUE && GetLastError() == ERROR_SHARING_VIOLATION) {
+            it->second = now;
+            wait = std::min(wait, (DWORD)WATCH_SETTLE_MS);
+            ++it;
+            continue;
+        }
+        if (h != INVALID_HANDLE_VALUE) {
+            CloseHandle(h);
+            std::filesystem::path full = it->first;
+            std::error_code ec;
+            if (!change) change = new LibraryChange{generation};
+            uint64_t size = fs::file_size(full, ec);
+            int64_t mtime = fs::last_write_time(full, ec).time_since_epoch().count();
+            change->added.push_back({full.filename().wstring(), full, size, mtime});
+        }
+        it = settling.erase(it);
+    }
+    PostLibraryChange(change);
+    return wait;
+}
+
+static void CloseWatchedRoot(WatchedRoot& w) {
+    CancelIoEx(w.dir, &w.ov);
+    DWORD bytes = 0;
+    GetOverlappedResult(w.dir, &w.ov, &bytes, TRUE);
+    if (w.notify) UnregisterDeviceNotification(w.notify);
+    CloseHandle(w.ov.hEvent);
+    CloseHandle(w.dir);
+}
+
+static void LibraryWatcherThread(std::vector<std::filesystem::path> roots, std::shared_ptr<WatcherControl> control, uint32_t generation) {
+    std::vector<std::unique_ptr<WatchedRoot>> watched;
+    for (const auto& root : roots) {
+        if (watched.size() + 2 >= MAXIMUM_WAIT_OBJECTS) break;
+        auto w = std::make_unique<WatchedRoot>();
+        w->path = root;
+        w->dir = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if (w->dir == INVALID_HANDLE_VALUE) continue;
+        w->ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (!w->ov.hEvent || !ArmWatch(*w)) {
+            if (w->ov.hEvent) CloseHandle(w->ov.hEvent);
+            CloseHandle(w->dir);
+            continue;
+        }
+        DEV_BROADCAST_HANDLE filter = {sizeof(filter), DBT_DEVTYP_HANDLE};
+        filter.dbch_handle = w->dir;
+        w->notify = RegisterDeviceNotificationW(g_MainWindow, &filter, DEVICE_NOTIFY_WINDOW_HANDLE);
+        watched.push_back(std::move(w));
+    }
+
+    std::vector<HANDLE> handles = {control->stop, control->release};
+    for (const auto& w : watched) handles.push_back(w->ov.hEvent);
+
+    SettlingFiles settling;
+    DWORD wait = INFINITE;
+    while (true) {
+        DWORD r = WaitForMultipleObjects((DWORD)handles.size(), handles.data(), FALSE, wait);
+        if (r == WAIT_OBJECT_0 || r == WAIT_FAILED) break;
+        if (r == WAIT_TIMEOUT) {
+            wait = FlushSettledFiles(settling, generation);
+            continue;
+        }
+        if (r == WAIT_OBJECT_0 + 1) {
+            HANDLE dir = control->releaseDir.exchange(NULL);
+            for (size_t j = 0; j < watched.size(); ++j) {
+                if (watched[j]->dir != dir) continue;
+                CloseWatchedRoot(*watched[j]);
+                watched.erase(watched.begin() + j);
+                handles.erase(handles.begin() + 2 + j);
+                break;
+            }
+            SetEvent(control->released);
+            continue;
+        }
+        size_t i = r - WAIT_OBJECT_0 - 2;
+        if (i >= watched.size()) break;
+
+        auto& w = *watched[i];
+        DWORD bytes = 0;
+        if (!GetOverlappedResult(w.dir, &w.ov, &bytes, FALSE) || bytes == 0) {
+            // Buffer overflow or a vanished drive: the event list is lost, walk the root again.
+            RescanRoot(w.path, generation);
+        } else {
+            DispatchWatchEvents(w, generation, settling);
+        }
+        // A root that can't be re-armed stays in the wait set with its event reset, i.e. never fires.
+        if (!ArmWatch(w)) ResetEvent(w.ov.hEvent);
+        wait = FlushSettledFiles(settling, generation);
+    }
+
+    for (auto& w : watched) CloseWatchedRoot(*w);
+}
+
+static void StopLibraryWatcher() {
+    if (g_Watcher) SetEvent(g_Watcher->stop);
+    g_Watcher.reset();
+}
+
+static void StartLibraryWatcher(const std::vector<std::filesystem::path>& roots, uint32_t generation) {
+    StopLibraryWatcher();
+    g_Watcher = std::make_shared<WatcherControl>();
+    std::thread(LibraryWatcherThread, roots, g_Watcher, generation).detach();
+}
+
+// Called from DBT_DEVICEQUERYREMOVE, which has to return with the handle
+// closed; the watcher is blocked in a wait, so this is only a round trip.
+static void ReleaseWatchedHandle(HANDLE dir) {
+    if (!g_Watcher) return;
+    g_Watcher->releaseDir = dir;
+    SetEvent(g_Watcher->release);
+    WaitForSingleObject(g_Watcher->released, 2000);
+}
+
+// --- Worker Pool ---
+// Fixed set of threads draining a FIFO of tasks. Queued tasks are dropped when
+// the pool is destroyed; the running ones are joined.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t count, int priority = THREAD_PRIORITY_NORMAL, const wchar_t* name = L"CitronWorker") : priority_(priority), name_(name) {
+        for (size_t i = 0; i < std::max<size_t>(1, count); ++i) threads_.emplace_back([this] { Run(); });
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+            tasks_.clear();
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+    void Push(std::function<void()> task) {
+        {
+            std::lock_guard lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        cv_.notify_one();
+    }
+    size_t Size() const { return threads_.size(); }
+
+private:
+    void Run() {
+        SetThreadPriority(GetCurrentThread(), priority_);
+        SetCurrentThreadName(name_);
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (stopping_) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    int priority_;
+    const wchar_t* name_;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+// --- Title Metadata ---
+// Title ID, localized name and a downscaled icon per ROM, extracted once by a
+// low-priority worker pool through the core's Loader and cached in the user
+// directory. Records live in metadata.idx; icons are fixed-size 32bpp ARGB
+// slots in icons.bin, which stays memory-mapped while the list is shown.
+// Slot n is always at n * ICON_BYTES: a torn tail left by an interrupted
+// append is ignored on load and cut off before the next append.
+const int ICON_DIM = 64;
+const size_t ICON_BYTES = ICON_DIM * ICON_DIM * 4;
+static const uint32_t METADATA_MAGIC = 0x54444D43; // "CMDT"
+static const uint32_t METADATA_VERSION = 2; // 2 added lastPlayed
+
+struct TitleMetadata {
+    std::wstring path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t title_id = 0;
+    std::wstring title;
+    int32_t iconSlot = -1;            // slot in the mapped icon blob
+    int64_t lastPlayed = 0;           // seconds since the epoch, 0 if never booted
+    std::vector<uint8_t> pendingIcon; // downscaled pixels not yet written to the blob
+};
+
+std::unordered_map<std::wstring, TitleMetadata> g_Metadata; // UI thread only
+std::unordered_set<std::wstring> g_MetadataQueued;
+bool g_MetadataDirty = false;
+std::unique_ptr<WorkerPool> g_MetadataPool;
+std::atomic<int> g_MetadataJobs = 0;
+// Opening a package registers its ticket keys with the KeyManager, which isn't
+// safe against concurrent readers; reads of an opened package only share it.
+std::shared_mutex g_LoaderMutex;
+
+HANDLE g_IconFile = INVALID_HANDLE_VALUE;
+HANDLE g_IconMapping = NULL;
+const uint8_t* g_IconView = nullptr;
+size_t g_IconSlots = 0;
+uint32_t g_IconPixelsGeneration = 0; // bumped whenever pointers from GetIconPixels may dangle
+
+static std::filesystem::path GetMetadataPath() { return GetUserDirectory() / "metadata.idx"; }
+static std::filesystem::path GetIconBlobPath() { return GetUserDirectory() / "icons.bin"; }
+
+static void UnmapIconBlob() {
+    ++g_IconPixelsGeneration;
+    if (g_IconView) UnmapViewOfFile(g_IconView);
+    if (g_IconMapping) CloseHandle(g_IconMapping);
+    if (g_IconFile != INVALID_HANDLE_VALUE) CloseHandle(g_IconFile);
+    g_IconView = nullptr; g_IconMapping = NULL; g_IconFile = INVALID_HANDLE_VALUE; g_IconSlots = 0;
+}
+
+static void MapIconBlob() {
+    UnmapIconBlob();
+    g_IconFile = CreateFileW(GetIconBlobPath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_IconFile == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(g_IconFile, &size) || size.QuadPart < (LONGLONG)ICON_BYTES) { UnmapIconBlob(); return; }
+    g_IconMapping = CreateFileMappingW(g_IconFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (g_IconMapping) g_IconView = static_cast<const uint8_t*>(MapViewOfFile(g_IconMapping, FILE_MAP_READ, 0, 0, 0));
+    if (!g_IconView) { UnmapIconBlob(); return; }
+    g_IconSlots = (size_t)size.QuadPart / ICON_BYTES; // whole slots only
+}
+
+static const uint8_t* GetIconPixels(const std::filesystem::path& path) {
+    auto it = g_Metadata.find(path.wstring());
+    if (it == g_Metadata.end()) return nullptr;
+    if (!it->second.pendingIcon.empty()) return it->second.pendingIcon.data();
+    if (it->second.iconSlot >= 0 && (size_t)it->second.iconSlot < g_IconSlots) return g_IconView + it->second.iconSlot * ICON_BYTES;
+    return nullptr;
+}
+
+static void LoadMetadataCache() {
+    g_Metadata.clear();
+    MapIconBlob();
+
+    std::ifstream in(GetMetadataPath(), std::ios::binary);
+    if (!in.is_open()) return;
+    uint32_t magic = 0, version = 0, dim = 0, count = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&dim), sizeof(dim));
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || magic != METADATA_MAGIC || version == 0 || version > METADATA_VERSION || dim != ICON_DIM) return;
+
+    std::unordered_map<std::wstring, TitleMetadata> records;
+    for (uint32_t i = 0; i < count; ++i) {
+        TitleMetadata m;
+        if (!ReadIndexString(in, m.path)) return;
+        in.read(reinterpret_cast<char*>(&m.size), sizeof(m.size));
+        in.read(reinterpret_cast<char*>(&m.mtime), sizeof(m.mtime));
+        in.read(reinterpret_cast<char*>(&m.title_id), sizeof(m.title_id));
+        if (!ReadIndexString(in, m.title)) return;
+        in.read(reinterpret_cast<char*>(&m.iconSlot), sizeof(m.iconSlot));
+        if (version >= 2) in.read(reinterpret_cast<char*>(&m.lastPlayed), sizeof(m.lastPlayed));
+        if (!in) return;
+        if ((size_t)m.iconSlot >= g_IconSlots) m.iconSlot = -1;
+        std::wstring key = m.path;
+        records.emplace(std::move(key), std::move(m));
+    }
+    g_Metadata = std::move(records);
+}
+
+static void SaveMetadataCache() {
+    if (!g_MetadataDirty) return;
+    g_MetadataDirty = false;
+    int64_t pendingBytes = 0; // charged to UiAssets, all written or dropped below
+    for (const auto& [path, m] : g_Metadata) pendingBytes += (int64_t)m.pendingIcon.size();
+
+    // Keep titles that are listed, plus those on drives that simply aren't plugged in.
+    // Pruning waits for the scan to finish, until then "not listed" means nothing.
+    bool dropped = false;
+    bool prune = g_ScanWorkersActive == 0;
+    for (auto it = g_Metadata.begin(); it != g_Metadata.end();) {
+        if (!prune || g_GamePaths.count(it->first) || !IsVolumeMounted(it->first)) { ++it; continue; }
+        if (it->second.iconSlot >= 0) dropped = true;
+        it = g_Metadata.erase(it);
+    }
+
+    auto blobPath = GetIconBlobPath();
+    auto blobTmp = blobPath; blobTmp += ".tmp";
+    if (dropped) {
+        // Orphaned slots: rewrite the blob compacted, reading old slots from the live mapping.
+        std::ofstream out(blobTmp, std::ios::binary | std::ios::trunc);
+        int32_t next = 0;
+        for (auto& [path, m] : g_Metadata) {
+            const uint8_t* px = !m.pendingIcon.empty() ? m.pendingIcon.data()
+                : (m.iconSlot >= 0 ? g_IconView + m.iconSlot * ICON_BYTES : nullptr);
+            if (!px) continue;
+            out.write(reinterpret_cast<const char*>(px), ICON_BYTES);
+            m.iconSlot = next++;
+        }
+        bool ok = (bool)out;
+        out.close();
+        UnmapIconBlob();
+        std::error_code ec;
+        if (ok) fs::rename(blobTmp, blobPath, ec);
+        for (auto& [path, m] : g_Metadata) {
+            m.pendingIcon.clear();
+            if (!ok || ec) m.iconSlot = -1;
+        }
+    } else {
+        int32_t next = (int32_t)g_IconSlots;
+        UnmapIconBlob();
+        std::error_code ec;
+        if (fs::exists(blobPath, ec)) fs::resize_file(blobPath, (uint64_t)next * ICON_BYTES, ec);
+        std::ofstream out(blobPath, std::ios::binary | std::ios::app);
+        for (auto& [path, m] : g_Metadata) {
+            if (m.pendingIcon.empty()) continue;
+            out.write(reinterpret_cast<const char*>(m.pendingIcon.data()), ICON_BYTES);
+            m.iconSlot = (!ec && out) ? next++ : -1;
+            m.pendingIcon.clear();
+        }
+    }
+    ReleaseMemory(MemoryCategory::UiAssets, pendingBytes);
+    MapIconBlob();
+
+    auto path = GetMetadataPath();
+    auto tmp = path; tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return;
+        uint32_t dim = ICON_DIM, count = (uint32_t)g_Metadata.size();
+        out.write(reinterpret_cast<const char*>(&METADATA_MAGIC), sizeof(METADATA_MAGIC));
+        out.write(reinterpret_cast<const char*>(&METADATA_VERSION), sizeof(METADATA_VERSION));
+        out.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const auto& [key, m] : g_Metadata) {
+            WriteIndexString(out, m.path);
+            out.write(reinterpret_cast<const char*>(&m.size), sizeof(m.size));
+            out.write(reinterpret_cast<const char*>(&m.mtime), sizeof(m.mtime));
+            out.write(reinterpret_cast<const char*>(&m.title_id), sizeof(m.title_id));
+            WriteIndexString(out, m.title);
+            out.write(reinterpret_cast<const char*>(&m.iconSlot), sizeof(m.iconSlot));
+            out.write(reinterpret_cast<const char*>(&m.lastPlayed), sizeof(m.lastPlayed));
+        }
+        if (!out) return;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+}
+
+// Decodes the NACP JPEG and box-filters it down to ICON_DIM through GDI+.
+static bool DownscaleIcon(const std::vector<u8>& jpeg, std::vector<uint8_t>& out) {
+    IStream* stream = SHCreateMemStream(jpeg.data(), (UINT)jpeg.size());
+    if (!stream) return false;
+    bool ok = false;
+    {
+        Bitmap src(stream);
+        Bitmap dst(ICON_DIM, ICON_DIM, PixelFormat32bppARGB);
+        if (src.GetLastStatus() == Ok && dst.GetLastStatus() == Ok) {
+            Graphics g(&dst);
+            g.SetInterpolationMode(InterpolationModeHighQualityBicubic);
+            g.SetPixelOffsetMode(PixelOffsetModeHighQuality);
+            g.DrawImage(&src, 0, 0, ICON_DIM, ICON_DIM);
+            BitmapData data;
+            Rect rect(0, 0, ICON_DIM, ICON_DIM);
+            if (dst.LockBits(&rect, ImageLockModeRead, PixelFormat32bppARGB, &data) == Ok) {
+                out.resize(ICON_BYTES);
+                for (int y = 0; y < ICON_DIM; ++y) {
+                    memcpy(out.data() + y * ICON_DIM * 4, static_cast<uint8_t*>(data.Scan0) + y * data.Stride, ICON_DIM * 4);
+                }
+                dst.UnlockBits(&data);
+                ok = true;
+            }
+        }
+    }
+    stream->Release();
+    return ok;
+}
+
+static void ExtractMetadataTask(std::filesystem::path path, uint64_t size, int64_t mtime) {
+    auto* result = new TitleMetadata{};
+    result->path = path.wstring();
+    result->size = size;
+    result->mtime = mtime;
+    try {
+        auto file = g_System->GetFilesystem()->OpenFile(WideToUtf8(path.wstring()), FileSys::OpenMode::Read);
+        if (file) {
+            std::unique_ptr<Loader::AppLoader> loader;
+            {
+                std::unique_lock lock(g_LoaderMutex);
+                loader = Loader::GetLoader(*g_System, file);
+            }
+            if (loader) {
+                std::shared_lock lock(g_LoaderMutex);
+                u64 program_id = 0;
+                std::string title;
+                std::vector<u8> icon;
+                if (loader->ReadProgramId(program_id) == Loader::ResultStatus::Success) result->title_id = program_id;
+                if (loader->ReadTitle(title) == Loader::ResultStatus::Success) result->title = Utf8ToWide(title);
+                if (loader->ReadIcon(icon) == Loader::ResultStatus::Success) DownscaleIcon(icon, result->pendingIcon);
+            }
+        }
+    } catch (...) {}
+
+    if (!PostMessageW(g_MainWindow, WM_APP_METADATA, 0, reinterpret_cast<LPARAM>(result))) delete result;
+    if (--g_MetadataJobs == 0) PostMessageW(g_MainWindow, WM_APP_METADATA_IDLE, 0, 0);
+}
+
+static void StartMetadataPool() {
+    if (g_MetadataPool) return;
+    // Half the cores at most: this runs while the user browses, not instead of it.
+    size_t workers = std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+    g_MetadataPool = std::make_unique<WorkerPool>(workers, THREAD_PRIORITY_BELOW_NORMAL, L"CitronMetadata");
+}
+
+// Fills a freshly listed game from the cache, or queues extraction when the
+// file is new or changed since it was cached.
+static void ApplyMetadata(Game& game) {
+    std::wstring key = game.path.wstring();
+    auto it = g_Metadata.find(key);
+    if (it != g_Metadata.end()) game.last_played = it->second.lastPlayed;
+    if (it != g_Metadata.end() && it->second.size == game.size && it->second.mtime == game.mtime) {
+        game.title_id = it->second.title_id;
+        game.title = it->second.title;
+        return;
+    }
+    if (!g_System || !g_MetadataQueued.insert(key).second) return;
+    StartMetadataPool();
+    ++g_MetadataJobs;
+    g_MetadataPool->Push([path = game.path, size = game.size, mtime = game.mtime] { ExtractMetadataTask(path, size, mtime); });
+}
+
+static void OnMetadataResult(std::unique_ptr<TitleMetadata> result) {
+    g_MetadataQueued.erase(result->path);
+    // Failures (usually missing keys) aren't cached so they are retried next launch.
+    if (result->title_id == 0) return;
+    for (auto& game : g_Games) {
+        if (game.path.wstring() == result->path) {
+            game.title_id = result->title_id;
+            game.title = result->title;
+            ScheduleGameOrderRebuild();
+            break;
+        }
+    }
+    std::wstring key = result->path;
+    auto existing = g_Metadata.find(key);
+    if (existing != g_Metadata.end()) {
+        result->lastPlayed = existing->second.lastPlayed;
+        ++g_IconPixelsGeneration;
+        ReleaseMemory(MemoryCategory::UiAssets, (int64_t)existing->second.pendingIcon.size());
+    }
+    ChargeMemory(MemoryCategory::UiAssets, (int64_t)result->pendingIcon.size());
+    g_Metadata[key] = std::move(*result);
+    g_MetadataDirty = true;
+}
+
+// --- Game List View ---
+// g_Games stays in arrival order. The list shows g_GameOrder, positions into
+// g_Games sorted by the current key, optionally narrowed to one initial.
+// Name order also fills g_LetterStart with the first position of each
+// initial, so letter jumps and the letter filter are plain range lookups.
+// The order is rebuilt lazily after the library or a title's name changes;
+// renames from metadata results are batched into one rebuild per
+// GAME_ORDER_BATCH_MS. The selected game and the letter filter survive
+// rebuilds, removals included.
+enum class GameSort { Name, LastPlayed, Size, Count };
+const wchar_t* GAME_SORT_NAMES[] = {L"Name", L"Last Played", L"Size"};
+const int LETTER_BUCKETS = 27; // '#' for digits and symbols, then A-Z
+
+GameSort g_GameSort = GameSort::Name;
+std::vector<int> g_GameOrder;
+int g_LetterStart[LETTER_BUCKETS + 1] = {}; // name sort only
+int g_LetterFilter = -1;                    // bucket shown alone, -1 for all
+bool g_GameOrderDirty = true;
+bool g_GameOrderBatchPending = false;
+std::wstring g_PendingSelection; // path of the selected game while the order is cleared
+const UINT GAME_ORDER_BATCH_MS = 250;
+
+static int GetLetterBucket(const Game& game) {
+    const std::wstring& name = GetDisplayName(game);
+    wchar_t c = name.empty() ? 0 : (wchar_t)towupper(name[0]);
+    return (c >= L'A' && c <= L'Z') ? 1 + (c - L'A') : 0;
+}
+
+static int GetGameViewBegin() { return g_LetterFilter < 0 ? 0 : g_LetterStart[g_LetterFilter]; }
+
+static int GetGameViewCount() {
+    if (g_LetterFilter < 0 || g_GameOrder.empty()) return (int)g_GameOrder.size();
+    return g_LetterStart[g_LetterFilter + 1] - g_LetterStart[g_LetterFilter];
+}
+
+static Game& GetViewGame(int pos) { return g_Games[g_GameOrder[GetGameViewBegin() + pos]]; }
+
+// Removals invalidate the g_Games indices the order holds, so it is dropped;
+// callers remember the selection first with RememberSelectedGame().
+static void InvalidateGameOrder(bool indicesChanged) {
+    if (indicesChanged) g_GameOrder.clear();
+    g_GameOrderDirty = true;
+}
+
+static void RememberSelectedGame() {
+    if (g_SelectedGameIndex >= 0 && g_SelectedGameIndex < GetGameViewCount()) g_PendingSelection = GetViewGame(g_SelectedGameIndex).path.wstring();
+}
+
+static void ScheduleGameOrderRebuild() {
+    if (g_GameOrderBatchPending) return;
+    g_GameOrderBatchPending = true;
+    SetTimer(g_MainWindow, GAME_ORDER_TIMER, GAME_ORDER_BATCH_MS, NULL);
+}
+
+static void RebuildGameOrder() {
+    if (!g_GameOrderDirty) return;
+    g_GameOrderDirty = false;
+    if (g_PendingSelection.empty()) RememberSelectedGame();
+    std::wstring keep = std::move(g_PendingSelection);
+    g_PendingSelection.clear();
+
+    size_t n = g_Games.size();
+    std::vector<uint8_t> buckets(n);
+    for (size_t i = 0; i < n; ++i) buckets[i] = (uint8_t)GetLetterBucket(g_Games[i]);
+    g_GameOrder.resize(n);
+    for (size_t i = 0; i < n; ++i) g_GameOrder[i] = (int)i;
+
+    auto byName = [&](int a, int b) {
+        if (buckets[a] != buckets[b]) return buckets[a] < buckets[b];
+        const std::wstring& x = GetDisplayName(g_Games[a]);
+        const std::wstring& y = GetDisplayName(g_Games[b]);
+        return CompareStringOrdinal(x.c_str(), (int)x.size(), y.c_str(), (int)y.size(), TRUE) == CSTR_LESS_THAN;
+    };
+    std::sort(g_GameOrder.begin(), g_GameOrder.end(), [&](int a, int b) {
+        const Game& x = g_Games[a];
+        const Game& y = g_Games[b];
+        if (g_GameSort == GameSort::LastPlayed && x.last_played != y.last_played) return x.last_played > y.last_played;
+        if (g_GameSort == GameSort::Size && x.size != y.size) return x.size > y.size;
+        return byName(a, b);
+    });
+
+    if (g_GameSort == GameSort::Name) {
+        int counts[LETTER_BUCKETS] = {};
+        for (uint8_t b : buckets) counts[b]++;
+        g_LetterStart[0] = 0;
+        for (int b = 0; b < LETTER_BUCKETS; ++b) g_LetterStart[b + 1] = g_LetterStart[b] + counts[b];
+    } else {
+        g_LetterFilter = -1;
+    }
+    if (g_LetterFilter >= 0 && GetGameViewCount() == 0) g_LetterFilter = -1; // its last title left
+
+    // The kept game's new position, or the old row when it is gone.
+    int pos = -1;
+    for (int i = 0; i < (int)n && !keep.empty(); ++i) {
+        if (g_Games[g_GameOrder[i]].path.wstring() == keep) { pos = i - GetGameViewBegin(); break; }
+    }
+    if (pos < 0 || pos >= GetGameViewCount()) pos = g_SelectedGameIndex;
+    g_SelectedGameIndex = std::clamp(pos, 0, std::max(0, GetGameViewCount() - 1));
+}
+
+static void MarkGamePlayed(const std::filesystem::path& path) {
+    int64_t now = (int64_t)_time64(NULL);
+    std::wstring key = path.wstring();
+    for (auto& game : g_Games) {
+        if (game.path.wstring() == key) { game.last_played = now; break; }
+    }
+    auto it = g_Metadata.find(key);
+    if (it != g_Metadata.end()) {
+        it->second.lastPlayed = now;
+        g_MetadataDirty = true;
+    }
+    if (g_GameSort == GameSort::LastPlayed) InvalidateGameOrder(false);
+}
+
+// UI-thread side of the list; scan batches and watcher events both land here.
+// A game already listed is updated instead: its metadata is read again when
+// the file changed or the last read failed, e.g. on a file still copying.
+static void AddGameToList(Game&& game) {
+    if (!g_GamePaths.insert(game.path.wstring()).second) {
+        for (auto& listed : g_Games) {
+            if (listed.path != game.path) continue;
+            if (listed.size == game.size && listed.mtime == game.mtime && listed.title_id != 0) break;
+            listed.size = game.size;
+            listed.mtime = game.mtime;
+            ApplyMetadata(listed);
+            InvalidateGameOrder(false);
+            break;
+        }
+        return;
+    }
+    ApplyMetadata(game);
+    g_Games.push_back(std::move(game));
+    InvalidateGameOrder(false);
+}
+
+static void RemoveGamesUnder(const std::filesystem::path& path) {
+    RememberSelectedGame();
+    std::wstring prefix = path.wstring();
+    auto it = std::remove_if(g_Games.begin(), g_Games.end(), [&](const Game& g) {
+        std::wstring p = g.path.wstring();
+        if (!IsUnderRoot(p, prefix)) return false;
+        g_GamePaths.erase(p);
+        return true;
+    });
+    g_Games.erase(it, g_Games.end());
+    InvalidateGameOrder(true);
+}
+
+std::vector<std::filesystem::path> g_SearchRoots; // roots of the current scan generation, UI thread only
+
+static void ScanGames() {
+    g_Games.clear();
+    g_GamePaths.clear();
+    InvalidateGameOrder(true);
+    g_PendingSelection.clear();
+    g_LetterFilter = -1;
+    g_SelectedGameIndex = 0;
+    uint32_t generation = ++g_ScanGeneration;
+    if (!g_LibraryIndexLoaded) LoadLibraryIndex();
+
+    // Only candidates are collected here; existence checks happen on the workers
+    // so a slow drive can't stall the UI thread.
+    std::vector<std::filesystem::path> searchPaths;
+    searchPaths.push_back("D:\\Games"); 
+
+    // Add user paths
+    for (const auto& p : g_UserGamePaths) {
+        bool found = false;
+        for(const auto& s : searchPaths) if(s == p) found = true;
+        if(!found) searchPaths.push_back(p);
+    }
+
+    // Auto-scan drives
+    DWORD drives = GetLogicalDrives();
+    for (char letter = 'E'; letter <= 'Z'; ++letter) {
+        if (!(drives & (1u << (letter - 'A')))) continue;
+        std::string drive = ""; drive += letter; drive += ":\\Games";
+        searchPaths.push_back(drive);
+    }
+
+    // Forget directories that no candidate root covers any more.
+    {
+        std::lock_guard lock(g_LibraryIndexMutex);
+        for (auto it = g_LibraryIndex.begin(); it != g_LibraryIndex.end();) {
+            bool covered = false;
+            for (const auto& root : searchPaths) if (IsUnderRoot(it->first, root.wstring())) { covered = true; break; }
+            if (!covered) it = g_LibraryIndex.erase(it);
+            else ++it;
+        }
+    }
+
+    g_ScanWorkersActive += (int)searchPaths.size();
+    for (const auto& path : searchPaths) {
+        std::thread(ScanRootThread, path, generation).detach();
+    }
+    StartLibraryWatcher(searchPaths, generation);
+    g_SearchRoots = std::move(searchPaths);
+}
+
+static std::vector<std::filesystem::path> GetDriveRoots(DWORD unitMask) {
+    std::vector<std::filesystem::path> roots;
+    for (const auto& root : g_SearchRoots) {
+        std::wstring s = root.wstring();
+        if (s.size() >= 2 && s[1] == L':' && iswalpha(s[0]) && (unitMask & (1u << (towupper(s[0]) - L'A')))) roots.push_back(root);
+    }
+    return roots;
+}
+
+// A volume came or went. Only the roots on that drive change: an arriving
+// E:-Z: drive gets its Games root scanned and watched, a removed drive's
+// titles leave the list. The rest of the library and the selection stay.
+static void OnDriveChange(DWORD unitMask, bool arrived) {
+    uint32_t generation = g_ScanGeneration;
+    if (!arrived) {
+        for (const auto& root : GetDriveRoots(unitMask)) RemoveGamesUnder(root);
+        return;
+    }
+    for (wchar_t letter = L'E'; letter <= L'Z'; ++letter) {
+        if (!(unitMask & (1u << (letter - L'A')))) continue;
+        std::filesystem::path root = std::wstring(1, letter) + L":\\Games";
+        if (std::find(g_SearchRoots.begin(), g_SearchRoots.end(), root) == g_SearchRoots.end()) g_SearchRoots.push_back(root);
+    }
+    // User paths on the drive are rescanned too; their watches were released on removal.
+    for (const auto& root : GetDriveRoots(unitMask)) RescanRoot(root, generation);
+    StartLibraryWatcher(g_SearchRoots, generation);
+}
+
+// --- Memory Budget ---
+// The job-object limit is sized from what the machine can actually commit and
+// from the selected memory layout, instead of a fixed 6 GiB. Guest DRAM is
+// committed up front by the core, so the layout dominates the budget. A
+// monitor thread watches process commit against the soft budget and asks the
+// registered trimmers of soft categories to give memory back before the hard
+// limit turns into failed allocations. Categories are what the frontend itself
+// holds and charges; a category with nothing charged isn't asked.
+const wchar_t* MEMORY_CATEGORY_NAMES[] = {L"Guest RAM", L"UI Assets", L"ROM Cache"};
+
+const uint64_t GIB = 1024ULL * 1024 * 1024;
+const uint64_t MIB = 1024ULL * 1024;
+const uint64_t HOST_OVERHEAD_BYTES = 2 * GIB;   // core, video driver, frontend
+const uint64_t HARD_LIMIT_HEADROOM = 512 * MIB; // between soft budget and job limit
+const uint64_t SYSTEM_RESERVE_BYTES = 512 * MIB; // never claim the last of system commit
+const double TRIM_THRESHOLD = 0.85;             // of the soft budget
+
+struct MemoryBudgetSnapshot {
+    uint64_t commit = 0;     // process private commit right now
+    uint64_t peakCommit = 0;
+    uint64_t budget = 0;     // soft budget, trimming starts below it
+    uint64_t jobLimit = 0;
+    int64_t categories[(int)MemoryCategory::Count] = {};
+};
+
+using MemoryTrimmer = std::function<void(bool hard)>; // hard: the job limit was hit, give back everything
+
+HANDLE g_JobObject = NULL;
+HANDLE g_JobPort = NULL;
+std::atomic<uint64_t> g_MemoryBudget = 0;
+std::atomic<uint64_t> g_JobLimit = 0;
+std::atomic<int64_t> g_MemoryCharged[(int)MemoryCategory::Count] = {};
+std::mutex g_TrimmerMutex;
+std::vector<std::pair<MemoryCategory, MemoryTrimmer>> g_MemoryTrimmers;
+
+static void ChargeMemory(MemoryCategory category, int64_t bytes) { g_MemoryCharged[(int)category] += bytes; }
+static void ReleaseMemory(MemoryCategory category, int64_t bytes) { g_MemoryCharged[(int)category] -= bytes; }
+
+static void RegisterMemoryTrimmer(MemoryCategory category, MemoryTrimmer trimmer) {
+    std::lock_guard lock(g_TrimmerMutex);
+    g_MemoryTrimmers.emplace_back(category, std::move(trimmer));
+}
+
+static uint64_t GetGuestMemoryBytes(Settings::MemoryLayout layout) {
+    switch (layout) {
+    case Settings::MemoryLayout::Memory_6Gb: return 6 * GIB;
+    case Settings::MemoryLayout::Memory_8Gb: return 8 * GIB;
+    default: return 4 * GIB;
+    }
+}
+
+static uint64_t GetProcessCommit(uint64_t* peak = nullptr) {
+    PROCESS_MEMORY_COUNTERS_EX pmc = {};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&pmc), sizeof(pmc))) return 0;
+    if (peak) *peak = pmc.PeakPagefileUsage;
+    return pmc.PrivateUsage;
+}
+
+// Most commit this process could ever hold: what it has plus what the system still offers.
+static uint64_t GetCommitCeiling() {
+    MEMORYSTATUSEX ms = {};
+    ms.dwLength = sizeof(ms);
+    if (!GlobalMemoryStatusEx(&ms)) return 6 * GIB;
+    uint64_t ceiling = GetProcessCommit() + ms.ullAvailPageFile;
+    return ceiling > SYSTEM_RESERVE_BYTES ? ceiling - SYSTEM_RESERVE_BYTES : ceiling;
+}
+
+// True when the layout fits at all; boot refuses layouts that can't instead of
+// letting the core die on its first failed commit.
+static bool SizeMemoryBudget(Settings::MemoryLayout layout) {
+    uint64_t ceiling = GetCommitCeiling();
+    uint64_t wanted = GetGuestMemoryBytes(layout) + HOST_OVERHEAD_BYTES;
+    uint64_t budget = std::min(wanted, ceiling);
+    uint64_t limit = std::min(budget + HARD_LIMIT_HEADROOM, ceiling);
+    g_MemoryBudget = budget;
+
+    if (g_JobObject) {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION jeli = {0};
+        jeli.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_PROCESS_MEMORY;
+        jeli.ProcessMemoryLimit = (SIZE_T)limit;
+        if (SetInformationJobObject(g_JobObject, JobObjectExtendedLimitInformation, &jeli, sizeof(jeli))) g_JobLimit = limit;
+    }
+    return GetGuestMemoryBytes(layout) + HOST_OVERHEAD_BYTES / 2 <= ceiling;
+}
+
+static MemoryBudgetSnapshot GetMemoryBudgetSnapshot() {
+    MemoryBudgetSnapshot snap;
+    snap.commit = GetProcessCommit(&snap.peakCommit);
+    snap.budget = g_MemoryBudget;
+    snap.jobLimit = g_JobLimit;
+    for (int i = 0; i < (int)MemoryCategory::Count; ++i) snap.categories[i] = g_MemoryCharged[i];
+    return snap;
+}
+
+// Largest charged category first; under pressure it stops once commit is back
+// below the threshold. The working set is left alone: emptying it gives back
+// no commit and would page guest RAM out in the middle of gameplay.
+static void TrimMemory(bool hard) {
+    std::vector<std::pair<MemoryCategory, MemoryTrimmer>> trimmers;
+    {
+        std::lock_guard lock(g_TrimmerMutex);
+        for (const auto& entry : g_MemoryTrimmers) {
+            if (entry.first != MemoryCategory::GuestRam) trimmers.push_back(entry);
+        }
+    }
+    std::stable_sort(trimmers.begin(), trimmers.end(), [](const auto& a, const auto& b) {
+        return g_MemoryCharged[(int)a.first] > g_MemoryCharged[(int)b.first];
+    });
+    for (const auto& [category, trim] : trimmers) {
+        if (g_MemoryCharged[(int)category] <= 0) continue;
+        trim(hard);
+        if (!hard && GetProcessCommit() <= (uint64_t)(g_MemoryBudget * TRIM_THRESHOLD)) break;
+    }
+}
+
+// Polls twice a second and wakes immediately when the job reports a commit
+// that hit the hard limit.
+static void MemoryMonitorThread() {
+    ULONGLONG lastTrim = 0;
+    while (true) {
+        DWORD msg = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED ov = nullptr;
+        bool limitHit = g_JobPort && GetQueuedCompletionStatus(g_JobPort, &msg, &key, &ov, 500) && msg == JOB_OBJECT_MSG_PROCESS_MEMORY_LIMIT;
+        if (!g_JobPort) Sleep(500);
+
+        uint64_t budget = g_MemoryBudget;
+        bool pressure = budget && GetProcessCommit() > (uint64_t)(budget * TRIM_THRESHOLD);
+        ULONGLONG now = GetTickCount64();
+        if (limitHit || (pressure && now - lastTrim >= 2000)) {
+            TrimMemory(limitHit);
+            lastTrim = now;
+        }
+    }
+}
+
+static void EnforceMemoryLimit() {
+    g_JobObject = CreateJobObject(NULL, NULL);
+    if (g_JobObject) {
+        SizeMemoryBudget(Settings::values.memory_layout_mode.GetValue());
+        if (!AssignProcessToJobObject(g_JobObject, GetCurrentProcess())) {
+            // Without the job the budget still drives trimming, there is just no hard stop.
+            g_JobLimit = 0;
+        }
+        g_JobPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        if (g_JobPort) {
+            JOBOBJECT_ASSOCIATE_COMPLETION_PORT port = {};
+            port.CompletionKey = g_JobObject;
+            port.CompletionPort = g_JobPort;
+            SetInformationJobObject(g_JobObject, JobObjectAssociateCompletionPortInformation, &port, sizeof(port));
+        }
+    } else {
+        SizeMemoryBudget(Settings::values.memory_layout_mode.GetValue());
+    }
+
+    // Pending icons are the UI's only heap-held asset; flushing them frees it.
+    RegisterMemoryTrimmer(MemoryCategory::UiAssets, [](bool) { PostMessageW(g_MainWindow, WM_APP_MEMORY_TRIM, 0, 0); });
+    std::thread(MemoryMonitorThread).detach();
+}
+
+// --- Settings Store ---
+// config.ini is described by SETTING_DEFS; a new setting is one row. Values
+// are ints, written by name when the row has a name list, or free text when
+// the row has text accessors. SaveSettings()
+// compares every value with what was last written and only when something
+// changed hands the new file to a writer thread, which writes it to a temp
+// file, flushes it and renames it over config.ini, so a crash leaves either
+// the old or the new file. Only a completed rename updates what counts as
+// written; a failed write is retried every SETTINGS_RETRY_MS until it goes
+// through or newer contents replace it. Keys are unique across sections.
+struct SettingDef {
+    const char* section;
+    const char* key;
+    int (*get)();
+    void (*set)(int);
+    int minValue, maxValue;
+    const char* const* names = nullptr; // indexed by value
+    std::string (*getText)() = nullptr;  // text rows ignore get/set and the range
+    void (*setText)(std::string_view) = nullptr;
+};
+
+const int LANGUAGE_COUNT = 18;      // the System tab cycles through these
+const int REGION_COUNT = 6;
+const int MEMORY_LAYOUT_COUNT = 3;
+const char* const UI_RENDERER_NAMES[] = {"gdiplus", "direct2d"};
+const char* const THREAD_PLACEMENT_KEYS[] = {"off", "soft", "pinned"};
+const Settings::AudioEngine AUDIO_ENGINES[] = {Settings::AudioEngine::Auto, Settings::AudioEngine::Cubeb, Settings::AudioEngine::Sdl2,
+                                               Settings::AudioEngine::Null};
+const char* const AUDIO_ENGINE_KEYS[] = {"auto", "cubeb", "sdl2", "null"};
+const int AUDIO_ENGINE_COUNT = (int)std::size(AUDIO_ENGINES);
+
+static int GetAudioEngineIndex() {
+    auto it = std::find(std::begin(AUDIO_ENGINES), std::end(AUDIO_ENGINES), Settings::values.sink_id.GetValue());
+    return it == std::end(AUDIO_ENGINES) ? 0 : (int)(it - std::begin(AUDIO_ENGINES));
+}
+
+// GetValue(true) on switchable settings: a running title's profile must not
+// leak into the global config.
+const SettingDef SETTING_DEFS[] = {
+    {"System", "Language", [] { return (int)Settings::values.language_index.GetValue(); },
+     [](int v) { Settings::values.language_index.SetValue((Settings::Language)v); }, 0, LANGUAGE_COUNT - 1},
+    {"System", "Region", [] { return (int)Settings::values.region_index.GetValue(); },
+     [](int v) { Settings::values.region_index.SetValue((Settings::Region)v); }, 0, REGION_COUNT - 1},
+    {"System", "CustomRTC", [] { return (int)Settings::values.custom_rtc_enabled.GetValue(); },
+     [](int v) { Settings::values.custom_rtc_enabled.SetValue(v != 0); }, 0, 1},
+    {"System", "MultiCore", [] { return (int)Settings::values.use_multi_core.GetValue(true); },
+     [](int v) { Settings::values.use_multi_core.SetValue(v != 0); }, 0, 1},
+    {"System", "MemoryLayout", [] { return (int)Settings::values.memory_layout_mode.GetValue(true); },
+     [](int v) { Settings::values.memory_layout_mode.SetValue((Settings::MemoryLayout)v); }, 0, MEMORY_LAYOUT_COUNT - 1},
+    {"System", "MenuPollRate", [] { return g_MenuPollRate; }, [](int v) { g_MenuPollRate = v; }, 30, 1000},
+    {"System", "LibrarySort", [] { return (int)g_GameSort; }, [](int v) { g_GameSort = (GameSort)v; }, 0, (int)GameSort::Count - 1},
+    {"System", "ThreadPlacement", [] { return (int)g_ThreadPlacement; }, [](int v) { g_ThreadPlacement = (ThreadPlacement)v; },
+     0, (int)ThreadPlacement::Count - 1, THREAD_PLACEMENT_KEYS},
+    {"Graphics", "PrewarmShaders", [] { return (int)g_PrewarmShaders; }, [](int v) { g_PrewarmShaders = v != 0; }, 0, 1},
+    {"Graphics", "UiRenderer", [] { return (int)g_UiRenderer; }, [](int v) { g_UiRenderer = (UiRendererKind)v; }, 0, 1, UI_RENDERER_NAMES},
+    {"Audio", "OutputEngine", GetAudioEngineIndex, [](int v) { Settings::values.sink_id.SetValue(AUDIO_ENGINES[v]); },
+     0, AUDIO_ENGINE_COUNT - 1, AUDIO_ENGINE_KEYS},
+    {"Audio", "OutputDevice", nullptr, nullptr, 0, 0, nullptr, [] { return Settings::values.audio_output_device_id.GetValue(); },
+     [](std::string_view v) { Settings::values.audio_output_device_id.SetValue(std::string(v)); }},
+    {"Audio", "Volume", [] { return (int)Settings::values.volume.GetValue(true); },
+     [](int v) { Settings::values.volume.SetValue((u8)v); }, 0, 200},
+};
+const size_t SETTING_COUNT = std::size(SETTING_DEFS);
+
+const int SETTINGS_RETRY_MS = 5000;
+
+// What config.ini holds right now, per row; empty when the key is missing.
+// Guarded by g_SettingsWriter.mutex once the writer thread runs.
+std::string g_SettingsWritten[SETTING_COUNT];
+std::vector<std::filesystem::path> g_GamePathsWritten;
+
+struct SettingsWriter {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string pending; // newest file contents, older ones are dropped
+    std::vector<std::string> pendingValues; // per row, what `pending` holds
+    std::vector<std::filesystem::path> pendingPaths;
+    bool hasPending = false;
+    bool stop = false;
+    std::thread thread;
+};
+
+SettingsWriter g_SettingsWriter;
+
+static std::string FormatSetting(const SettingDef& def) {
+    if (def.getText) return def.getText();
+    int v = def.get();
+    if (def.names && v >= def.minValue && v <= def.maxValue) return def.names[v];
+    return std::to_string(v);
+}
+
+static bool ParseSetting(const SettingDef& def, std::string_view text, int& out) {
+    if (def.names) {
+        for (int i = def.minValue; i <= def.maxValue; ++i) {
+            if (text == def.names[i]) { out = i; return true; }
+        }
+    }
+    int v = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), v);
+    if (ec != std::errc() || end != text.data() + text.size()) return false;
+    out = std::clamp(v, def.minValue, def.maxValue);
+    return true;
+}
+
+static void AddGamePath(const std::filesystem::path& path) {
+    if (std::find(g_UserGamePaths.begin(), g_UserGamePaths.end(), path) == g_UserGamePaths.end()) g_UserGamePaths.push_back(path);
+}
+
+static bool WriteFileAtomic(const std::filesystem::path& path, const std::string& contents) {
+    auto tmp = path;
+    tmp += ".tmp";
+    HANDLE h = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    DWORD written = 0;
+    bool ok = WriteFile(h, contents.data(), (DWORD)contents.size(), &written, NULL) && written == contents.size() && FlushFileBuffers(h);
+    CloseHandle(h);
+    if (ok) ok = MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    if (!ok) DeleteFileW(tmp.c_str());
+    return ok;
+}
+
+static void SettingsWriterThread() {
+    auto& w = g_SettingsWriter;
+    std::unique_lock lock(w.mutex);
+    for (;;) {
+        w.cv.wait(lock, [&] { return w.hasPending || w.stop; });
+        if (!w.hasPending) return;
+        std::string contents = std::move(w.pending);
+        auto values = std::move(w.pendingValues);
+        auto paths = std::move(w.pendingPaths);
+        w.hasPending = false;
+        lock.unlock();
+        bool ok = WriteFileAtomic(GetConfigPath(), contents);
+        lock.lock();
+        if (ok) {
+            for (size_t i = 0; i < SETTING_COUNT; ++i) g_SettingsWritten[i] = std::move(values[i]);
+            g_GamePathsWritten = std::move(paths);
+            continue;
+        }
+        // Full or read-only drive: keep the contents unless newer ones arrived meanwhile.
+        if (w.stop) return;
+        if (!w.hasPending) {
+            w.pending = std::move(contents);
+            w.pendingValues = std::move(values);
+            w.pendingPaths = std::move(paths);
+            w.hasPending = true;
+        }
+        w.cv.wait_for(lock, std::chrono::milliseconds(SETTINGS_RETRY_MS), [&] { return w.stop; });
+    }
+}
+
+static void SaveSettings() {
+    auto& w = g_SettingsWriter;
+    std::vector<std::string> values(SETTING_COUNT);
+    for (size_t i = 0; i < SETTING_COUNT; ++i) values[i] = FormatSetting(SETTING_DEFS[i]);
+    {
+        std::lock_guard lock(w.mutex);
+        bool dirty = g_UserGamePaths != g_GamePathsWritten;
+        for (size_t i = 0; i < SETTING_COUNT; ++i) {
+            if (values[i] != g_SettingsWritten[i]) dirty = true;
+        }
+        if (!dirty) return;
+    }
+
+    std::string contents;
+    const char* section = nullptr;
+    for (size_t i = 0; i < SETTING_COUNT; ++i) {
+        const SettingDef& def = SETTING_DEFS[i];
+        if (!section || strcmp(section, def.section) != 0) {
+            contents += fmt::format("{}[{}]\n", section ? "\n" : "", def.section);
+            section = def.section;
+        }
+        contents += fmt::format("{}={}\n", def.key, values[i]);
+    }
+    contents += "\n[Paths]\n";
+    for (const auto& p : g_UserGamePaths) contents += "GamePath=" + WideToUtf8(p.wstring()) + "\n";
+
+    std::lock_guard lock(w.mutex);
+    w.pending = std::move(contents);
+    w.pendingValues = std::move(values);
+    w.pendingPaths = g_UserGamePaths;
+    w.hasPending = true;
+    if (!w.thread.joinable()) w.thread = std::thread(SettingsWriterThread);
+    w.cv.notify_one();
+}
+
+// Waits for the last queued write; called once on shutdown.
+static void FlushSettings() {
+    auto& w = g_SettingsWriter;
+    {
+        std::lock_guard lock(w.mutex);
+        w.stop = true;
+    }
+    w.cv.notify_one();
+    if (w.thread.joinable()) w.thread.join();
+}
+
+static std::string_view TrimView(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+static void LoadSettings() {
+    HANDLE h = CreateFileW(GetConfigPath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size;
+    std::string text;
+    DWORD read = 0;
+    if (GetFileSizeEx(h, &size) && size.QuadPart < 16 * MIB) {
+        text.resize((size_t)size.QuadPart);
+        if (!ReadFile(h, text.data(), (DWORD)text.size(), &read, NULL)) read = 0;
+    }
+    CloseHandle(h);
+    text.resize(read);
+
+    g_UserGamePaths.clear();
+    std::string_view rest = text;
+    if (rest.substr(0, 3) == "\xEF\xBB\xBF") rest.remove_prefix(3);
+    while (!rest.empty()) {
+        size_t nl = rest.find('\n');
+        std::string_view line = TrimView(rest.substr(0, nl));
+        rest.remove_prefix(nl == std::string_view::npos ? rest.size() : nl + 1);
+        size_t eq = line.find('=');
+        if (line.empty() || line[0] == '[' || eq == std::string_view::npos) continue;
+
+        std::string_view key = TrimView(line.substr(0, eq));
+        std::string_view val = TrimView(line.substr(eq + 1));
+        if (key == "GamePath") {
+            AddGamePath(Utf8ToWide(std::string(val)));
+            continue;
+        }
+        for (size_t i = 0; i < SETTING_COUNT; ++i) {
+            int v;
+            if (key != SETTING_DEFS[i].key) continue;
+            if (SETTING_DEFS[i].setText) SETTING_DEFS[i].setText(val);
+            else if (ParseSetting(SETTING_DEFS[i], val, v)) SETTING_DEFS[i].set(v);
+            else continue;
+            g_SettingsWritten[i] = val;
+        }
+    }
+    g_GamePathsWritten = g_UserGamePaths;
+}
+
+// --- Install Engine ---
+// Folder installs (keys, firmware) copy with unbuffered overlapped I/O,
+// several files at once, each kept INSTALL_SLOTS chunks deep in flight.
+// A file is skipped when the destination already matches: the journal
+// remembers which source (size, mtime) each destination was written from,
+// and same-size files without a record are compared by content hash.
+// Copies land in "<name>.part" and the journal checkpoints the contiguous
+// prefix written so far, so an interrupted install resumes mid-file.
+// Progress is published through atomics; only the phase text takes a lock.
+const DWORD INSTALL_CHUNK = 4 * 1024 * 1024;
+const int INSTALL_SLOTS = 4;
+const int INSTALL_PARALLEL_FILES = 3;
+const DWORD INSTALL_ALIGN = 4096;                  // covers 512e and 4Kn sectors
+const uint64_t INSTALL_CHECKPOINT_BYTES = 256 * MIB;
+
+struct InstallProgress {
+    std::atomic<uint64_t> bytesTotal = 0;
+    std::atomic<uint64_t> bytesDone = 0;   // copied or skipped
+    std::atomic<uint64_t> bytesCopied = 0; // actually written, drives the rate
+    std::atomic<uint32_t> filesTotal = 0;
+    std::atomic<uint32_t> filesDone = 0;
+    std::atomic<uint32_t> filesSkipped = 0;
+    std::atomic<ULONGLONG> startTick = 0;
+    std::mutex mutex; // guards phase
+    std::wstring phase;
+};
+
+InstallProgress g_InstallProgress;
+
+struct InstallResult {
+    bool ok = false;
+    std::wstring message;
+    uint32_t copied = 0;
+    uint32_t skipped = 0;
+    bool resumable = false; // folder installs keep a journal
+};
+
+struct InstallJournalEntry {
+    bool complete = false;
+    uint64_t srcSize = 0;
+    int64_t srcMtime = 0;
+    uint64_t value = 0; // content hash when complete, checkpoint offset otherwise
+};
+
+struct InstallJob {
+    fs::path source;
+    fs::path dest;
+    fs::path journalPath;
+    std::mutex journalMutex;
+    std::unordered_map<std::string, InstallJournalEntry> journal; // relative UTF-8 path
+    std::atomic<bool> failed = false;
+    std::mutex errorMutex;
+    std::wstring error;
+};
+
+struct InstallFile {
+    fs::path rel;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+static void SetInstallPhase(const std::wstring& phase) {
+    std::lock_guard lock(g_InstallProgress.mutex);
+    g_InstallProgress.phase = phase;
+}
+
+// Two-line status for RenderUI; safe to call while the workers run.
+static std::wstring GetInstallStatusText() {
+    auto& p = g_InstallProgress;
+    std::wstring phase;
+    {
+        std::lock_guard lock(p.mutex);
+        phase = p.phase;
+    }
+    uint64_t total = p.bytesTotal, done = p.bytesDone, copied = p.bytesCopied;
+    if (total == 0) return phase;
+    double secs = std::max(0.001, (GetTickCount64() - p.startTick) / 1000.0);
+    double rate = copied / secs;
+    wchar_t line[160];
+    int pos = swprintf_s(line, L"\n%u / %u files   %.1f / %.1f GB", (unsigned)p.filesDone, (unsigned)p.filesTotal, done / (double)GIB, total / (double)GIB);
+    if (rate > 0 && done < total) {
+        uint64_t eta = (uint64_t)((total - done) / rate);
+        swprintf_s(line + pos, std::size(line) - pos, L"   %.0f MB/s   ETA %llu:%02llu", rate / MIB, eta / 60, eta % 60);
+    }
+    return phase + line;
+}
+
+// Order-independent so chunks can be hashed as reads complete.
+static uint64_t HashInstallChunk(const uint8_t* data, size_t len, uint64_t index) {
+    uint64_t h = 14695981039346656037ULL ^ (index * 0x9E3779B97F4A7C15ULL);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h * (2 * index + 1);
+}
+
+// Hashes [0, length) of a file in INSTALL_CHUNK units, matching the copy path.
+static bool HashInstallFile(const fs::path& path, uint64_t length, uint8_t* buffer, uint64_t& hash) {
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    hash = 0;
+    bool ok = true;
+    for (uint64_t offset = 0, index = 0; offset < length; offset += INSTALL_CHUNK, ++index) {
+        DWORD want = (DWORD)std::min<uint64_t>(INSTALL_CHUNK, length - offset), got = 0;
+        if (!ReadFile(h, buffer, want, &got, NULL) || got != want) { ok = false; break; }
+        hash += HashInstallChunk(buffer, got, index);
+    }
+    CloseHandle(h);
+    return ok;
+}
+
+static fs::path GetInstallJournalPath(const fs::path& dest) {
+    std::string key = WideToUtf8(dest.lexically_normal().wstring());
+    uint64_t h = HashInstallChunk(reinterpret_cast<const uint8_t*>(key.data()), key.size(), 0);
+    return GetUserDirectory() / "cache" / "install" / fmt::format("{:016X}.journal", h);
+}
+
+// Lines are "C <hash> <size> <mtime> <path>" for finished files and
+// "P <offset> <size> <mtime> <path>" for checkpoints; the last line wins.
+static void LoadInstallJournal(InstallJob& job) {
+    std::ifstream in(job.journalPath, std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        char kind = 0;
+        unsigned long long value = 0, size = 0;
+        long long mtime = 0;
+        int consumed = 0;
+        if (sscanf_s(line.c_str(), "%c %llx %llu %lld %n", &kind, 1, &value, &size, &mtime, &consumed) != 4 || consumed <= 0) continue;
+        if (kind != 'C' && kind != 'P') continue;
+        job.journal[line.substr(consumed)] = {kind == 'C', size, mtime, value};
+    }
+}
+
+static void AppendInstallJournal(InstallJob& job, const std::string& rel, const InstallJournalEntry& e) {
+    std::lock_guard lock(job.journalMutex);
+    job.journal[rel] = e;
+    std::ofstream out(job.journalPath, std::ios::binary | std::ios::app);
+    out << fmt::format("{} {:x} {} {} {}\n", e.complete ? 'C' : 'P', e.value, e.srcSize, e.srcMtime, rel);
+}
+
+static void FailInstall(InstallJob& job, const std::wstring& message) {
+    std::lock_guard lock(job.errorMutex);
+    if (!job.failed.exchange(true)) job.error = message;
+}
+
+struct InstallSlot {
+    OVERLAPPED ov = {};
+    uint8_t* buffer = nullptr;
+    uint64_t offset = 0;
+    DWORD length = 0; // valid bytes in buffer
+    bool writing = false;
+    bool busy = false;
+};
+
+// Copies src into part from `resumeFrom`, accumulating the content hash.
+// Returns false with GetLastError() set on any I/O failure.
+static bool CopyFileOverlapped(InstallJob& job, const fs::path& src, const fs::path& part, const InstallFile& file, const std::string& rel,
+                               uint64_t resumeFrom, uint8_t* buffers, uint64_t& hash) {
+    HANDLE in = CreateFileW(src.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (in == INVALID_HANDLE_VALUE) return false;
+    HANDLE out = CreateFileW(part.c_str(), GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+    if (out == INVALID_HANDLE_VALUE) { DWORD err = GetLastError(); CloseHandle(in); SetLastError(err); return false; }
+    FILE_ALLOCATION_INFO alloc = {};
+    alloc.AllocationSize.QuadPart = (LONGLONG)file.size;
+    SetFileInformationByHandle(out, FileAllocationInfo, &alloc, sizeof(alloc));
+
+    InstallSlot slots[INSTALL_SLOTS];
+    HANDLE events[INSTALL_SLOTS];
+    for (int i = 0; i < INSTALL_SLOTS; ++i) {
+        slots[i].buffer = buffers + (size_t)i * INSTALL_CHUNK;
+        slots[i].ov.hEvent = events[i] = CreateEventW(NULL, TRUE, FALSE, NULL);
+    }
+
+    uint64_t nextRead = resumeFrom;
+    // Writes finish out of order; the checkpoint only covers the contiguous prefix.
+    std::vector<bool> written((size_t)((file.size + INSTALL_CHUNK - 1) / INSTALL_CHUNK));
+    uint64_t watermark = resumeFrom, lastCheckpoint = resumeFrom;
+    DWORD error = ERROR_SUCCESS;
+
+    auto issue = [&](InstallSlot& s, bool write) {
+        s.ov.Offset = (DWORD)s.offset;
+        s.ov.OffsetHigh = (DWORD)(s.offset >> 32);
+        s.writing = write;
+        s.busy = true;
+        BOOL ok = write ? WriteFile(out, s.buffer, (s.length + INSTALL_ALIGN - 1) / INSTALL_ALIGN * INSTALL_ALIGN, NULL, &s.ov)
+                        : ReadFile(in, s.buffer, INSTALL_CHUNK, NULL, &s.ov);
+        if (!ok && GetLastError() != ERROR_IO_PENDING) { error = GetLastError(); s.busy = false; }
+    };
+    auto issueRead = [&](InstallSlot& s) {
+        if (nextRead >= file.size || job.failed || error != ERROR_SUCCESS) return;
+        s.offset = nextRead;
+        nextRead += INSTALL_CHUNK;
+        issue(s, false);
+    };
+    for (auto& s : slots) issueRead(s);
+
+    for (;;) {
+        HANDLE waitOn[INSTALL_SLOTS];
+        int map[INSTALL_SLOTS], count = 0;
+        for (int i = 0; i < INSTALL_SLOTS; ++i) if (slots[i].busy) { map[count] = i; waitOn[count++] = events[i]; }
+        if (count == 0) break;
+        DWORD w = WaitForMultipleObjects(count, waitOn, FALSE, INFINITE);
+        if (w >= WAIT_OBJECT_0 + (DWORD)count) { error = GetLastError(); break; }
+        InstallSlot& s = slots[map[w - WAIT_OBJECT_0]];
+        DWORD bytes = 0;
+        s.busy = false;
+        if (!GetOverlappedResult(s.writing ? out : in, &s.ov, &bytes, FALSE) && GetLastError() != ERROR_HANDLE_EOF) {
+            if (error == ERROR_SUCCESS) error = GetLastError();
+            continue;
+        }
+        ResetEvent(s.ov.hEvent);
+        if (error != ERROR_SUCCESS || job.failed) continue;
+        if (!s.writing) {
+            s.length = (DWORD)std::min<uint64_t>(bytes, file.size - s.offset);
+            hash += HashInstallChunk(s.buffer, s.length, s.offset / INSTALL_CHUNK);
+            issue(s, true);
+            continue;
+        }
+        g_InstallProgress.bytesDone += s.length;
+        g_InstallProgress.bytesCopied += s.length;
+        written[(size_t)(s.offset / INSTALL_CHUNK)] = true;
+        while (watermark < file.size && written[(size_t)(watermark / INSTALL_CHUNK)])
+            watermark = std::min(file.size, watermark + INSTALL_CHUNK);
+        if (watermark - lastCheckpoint >= INSTALL_CHECKPOINT_BYTES && watermark < file.size) {
+            AppendInstallJournal(job, rel, {false, file.size, file.mtime, watermark});
+            lastCheckpoint = watermark;
+        }
+        issueRead(s);
+    }
+
+    if (error == ERROR_SUCCESS && !job.failed) {
+        // The last write was padded to the sector size.
+        FILE_END_OF_FILE_INFO eof = {};
+        eof.EndOfFile.QuadPart = (LONGLONG)file.size;
+        if (!SetFileInformationByHandle(out, FileEndOfFileInfo, &eof, sizeof(eof))) error = GetLastError();
+    }
+    for (HANDLE e : events) CloseHandle(e);
+    CloseHandle(in);
+    CloseHandle(out);
+    SetLastError(error);
+    return error == ERROR_SUCCESS && !job.failed;
+}
+
+static void InstallOneFile(InstallJob& job, const InstallFile& file, uint8_t* buffers) {
+    TRACE_SCOPE("InstallOneFile");
+    fs::path src = job.source / file.rel;
+    fs::path dst = job.dest / file.rel;
+    fs::path part = dst; part += L".part";
+    std::string rel = WideToUtf8(file.rel.generic_wstring());
+    auto& progress = g_InstallProgress;
+
+    InstallJournalEntry entry;
+    {
+        std::lock_guard lock(job.journalMutex);
+        auto it = job.journal.find(rel);
+        if (it != job.journal.end()) entry = it->second;
+    }
+    bool sameSource = entry.srcSize == file.size && entry.srcMtime == file.mtime;
+
+    std::error_code ec;
+    uint64_t dstSize = fs::exists(dst, ec) ? fs::file_size(dst, ec) : UINT64_MAX;
+    if (dstSize == file.size) {
+        bool match = entry.complete && sameSource;
+        uint64_t srcHash = 0, dstHash = 0;
+        if (!match && HashInstallFile(src, file.size, buffers, srcHash) && HashInstallFile(dst, file.size, buffers, dstHash)) {
+            match = srcHash == dstHash;
+            if (match) AppendInstallJournal(job, rel, {true, file.size, file.mtime, srcHash});
+        }
+        if (match) {
+            progress.bytesDone += file.size;
+            progress.filesSkipped++;
+            progress.filesDone++;
+            return;
+        }
+    }
+
+    fs::create_directories(dst.parent_path(), ec);
+    uint64_t resumeFrom = 0, hash = 0;
+    if (!entry.complete && sameSource && entry.value > 0 && fs::exists(part, ec) && fs::file_size(part, ec) >= entry.value &&
+        HashInstallFile(part, entry.value, buffers, hash)) {
+        resumeFrom = entry.value;
+        progress.bytesDone += resumeFrom;
+    } else {
+        fs::remove(part, ec);
+        hash = 0;
+    }
+
+    if (file.size > 0 && !CopyFileOverlapped(job, src, part, file, rel, resumeFrom, buffers, hash)) {
+        if (job.failed) return;
+        // Unbuffered I/O is refused by some network and removable volumes.
+        DWORD err = GetLastError();
+        if (err != ERROR_INVALID_PARAMETER && err != ERROR_NOT_SUPPORTED) {
+            FailInstall(job, L"Copy failed for " + file.rel.wstring() + L" (error " + std::to_wstring(err) + L")");
+            return;
+        }
+        progress.bytesDone -= std::min<uint64_t>(progress.bytesDone, resumeFrom);
+        if (!CopyFileExW(src.c_str(), part.c_str(), NULL, NULL, NULL, 0) || !HashInstallFile(part, file.size, buffers, hash)) {
+            FailInstall(job, L"Copy failed for " + file.rel.wstring() + L" (error " + std::to_wstring(GetLastError()) + L")");
+            return;
+        }
+        progress.bytesDone += file.size;
+        progress.bytesCopied += file.size;
+    } else if (file.size == 0) {
+        std::ofstream(part, std::ios::binary | std::ios::trunc).close();
+    }
+
+    if (!MoveFileExW(part.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        FailInstall(job, L"Could not replace " + dst.wstring() + L" (error " + std::to_wstring(GetLastError()) + L")");
+        return;
+    }
+    AppendInstallJournal(job, rel, {true, file.size, file.mtime, hash});
+    progress.filesDone++;
+}
+
+static void InstallFilesThread(HWND hwnd, std::filesystem::path sourcePath, std::filesystem::path dest_dir) {
+    TRACE_THREAD_NAME("Install");
+    TRACE_SCOPE("InstallFilesThread");
+    auto result = std::make_unique<InstallResult>();
+    result->resumable = true;
+    InstallJob job;
+    job.source = sourcePath;
+    job.dest = dest_dir;
+    job.journalPath = GetInstallJournalPath(dest_dir);
+
+    SetInstallPhase(L"Reading source folder...");
+    std::vector<InstallFile> files;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(sourcePath, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        InstallFile f;
+        f.rel = it->path().lexically_relative(sourcePath);
+        f.size = it->file_size(ec);
+        f.mtime = it->last_write_time(ec).time_since_epoch().count();
+        files.push_back(std::move(f));
+    }
+    if (ec) {
+        result->message = L"Could not read " + sourcePath.wstring();
+    } else {
+        // Largest first keeps the parallel workers evenly loaded at the end.
+        std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.size > b.size; });
+        uint64_t total = 0;
+        for (const auto& f : files) total += f.size;
+        g_InstallProgress.bytesTotal = total;
+        g_InstallProgress.filesTotal = (uint32_t)files.size();
+        g_InstallProgress.startTick = GetTickCount64();
+
+        fs::create_directories(dest_dir, ec);
+        fs::create_directories(job.journalPath.parent_path(), ec);
+        LoadInstallJournal(job);
+        SetInstallPhase(L"Copying files...");
+
+        std::atomic<size_t> next = 0;
+        auto worker = [&] {
+            auto* buffers = static_cast<uint8_t*>(VirtualAlloc(NULL, (size_t)INSTALL_CHUNK * INSTALL_SLOTS, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+            if (!buffers) { FailInstall(job, L"Out of memory"); return; }
+            for (size_t i; !job.failed && (i = next++) < files.size();) InstallOneFile(job, files[i], buffers);
+            VirtualFree(buffers, 0, MEM_RELEASE);
+        };
+        int threads = (int)std::min<size_t>(INSTALL_PARALLEL_FILES, std::max<size_t>(1, files.size()));
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+
+        result->ok = !job.failed;
+        result->message = job.error;
+        result->skipped = g_InstallProgress.filesSkipped;
+        result->copied = g_InstallProgress.filesDone - result->skipped;
+        if (result->ok) {
+            SetInstallPhase(L"Done!");
+            if (result->copied > 0) {
+                RebuildFirmwareManifest();
+                StartWarmup(true);
+            }
+        } else {
+            SetInstallPhase(L"Error!");
+        }
+    }
+    if (PostMessageW(hwnd, WM_APP_INSTALL_DONE, 0, (LPARAM)result.get())) result.release();
+}
+
+static void StartInstall(HWND hwnd, const std::filesystem::path& source, const std::filesystem::path& dest) {
+    auto& p = g_InstallProgress;
+    p.bytesTotal = p.bytesDone = p.bytesCopied = 0;
+    p.filesTotal = p.filesDone = p.filesSkipped = 0;
+    SetInstallPhase(L"Starting...");
+    g_IsInstalling = true;
+    SetTimer(hwnd, INSTALL_REFRESH_TIMER, 250, NULL);
+    InvalidateRect(hwnd, NULL, FALSE);
+    std::thread(InstallFilesThread, hwnd, source, dest).detach();
+}
+
+static void OnInstallDone(HWND hwnd, std::unique_ptr<InstallResult> result) {
+    KillTimer(hwnd, INSTALL_REFRESH_TIMER);
+    g_IsInstalling = false;
+    InvalidateRect(hwnd, NULL, FALSE);
+    if (result->ok && result->resumable) {
+        std::wstring msg = L"Files Copied! (" + std::to_wstring(result->copied) + L" copied, " + std::to_wstring(result->skipped) + L" already up to date)";
+        MessageBoxW(hwnd, msg.c_str(), L"Success", MB_OK);
+    } else if (result->ok) {
+        MessageBoxW(hwnd, result->message.c_str(), L"Success", MB_OK);
+    } else {
+        std::wstring msg = L"Failed: " + result->message;
+        if (result->resumable) msg += L"\nRun the install again to resume.";
+        MessageBoxW(hwnd, msg.c_str(), L"Error", MB_OK);
+    }
+}
+
+static void InstallFiles(HWND hwnd, const std::wstring& title, const std::filesystem::path& subPath) {
+    if (g_IsInstalling) return;
+    std::filesystem::path dest_dir = GetUserDirectory() / subPath;
+    
+    IFileOpenDialog* pFileOpen;
+    HRESULT hr = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL, IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileOpen));
+    if (SUCCEEDED(hr)) {
+        pFileOpen->SetTitle(title.c_str());
+        pFileOpen->SetOptions(FOS_PICKFOLDERS);
+        if (SUCCEEDED(pFileOpen->Show(hwnd))) {
+            IShellItem* pItem;
+            if (SUCCEEDED(pFileOpen->GetResult(&pItem))) {
+                PWSTR pszFilePath;
+                if (SUCCEEDED(pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath))) {
+                    std::wstring source(pszFilePath);
+                    CoTaskMemFree(pszFilePath);
+                    
+                    if (title == L"Add Game Directory") {
+                        // Store path and save immediately
+                        AddGamePath(source);
+                        SaveSettings();
+                        ScanGames();    
+                        InvalidateRect(hwnd, NULL, FALSE);
+                        MessageBoxW(hwnd, L"Game Directory Saved!", L"Citron", MB_OK);
+                    } else {
+                        StartInstall(hwnd, source, dest_dir);
+                    }
+                }
+                pItem->Release();
+            }
+        }
+        pFileOpen->Release();
+    }
+}
+
+// --- UI Canvas ---
+// RenderUI draws through UiCanvas so the backend is a config choice
+// (UiRenderer=direct2d|gdiplus). Colours and fonts are addressed by slot;
+// each backend creates its brushes and fonts once and keeps its surface
+// between paints. The video core creates its own device and swapchain from
+// the HWND, so nothing can be shared with it: the Direct2D target is dropped
+// before a boot starts and the boot screen is drawn with GDI+.
+enum class UiColor { Bg, Accent, Text, Dim, SelText, ItemBg, Selected, Highlight, Editing, TabInactive, Count };
+enum class UiFont { Title, Status, Head, Item, Label, Tab, Hint, Count };
+enum class UiAlign { Center, Left, LeftMid, RightMid, Count };
+
+const Color UI_COLORS[] = {
+    COLOR_BG, COLOR_ACCENT, COLOR_TEXT, COLOR_TEXT_DIM, COLOR_TEXT_SELECTED,
+    COLOR_ITEM_BG, COLOR_ITEM_SELECTED, COLOR_HIGHLIGHT_BROWN, COLOR_EDITING, COLOR_TAB_INACTIVE,
+};
+
+struct UiFontSpec { float size; bool bold; };
+const UiFontSpec UI_FONTS[] = {{28, true}, {24, false}, {22, false}, {20, false}, {18, false}, {16, true}, {14, false}};
+
+class UiCanvas {
+public:
+    virtual ~UiCanvas() = default;
+    // Runs RenderUI limited to `dirty` and puts the result on screen.
+    virtual void Paint(HWND hwnd, HDC hdc, const RECT& dirty) = 0;
+    virtual void Resize(HWND hwnd) = 0;
+    // Drops the window-bound surface; the next Paint recreates it.
+    virtual void ReleaseSurface() = 0;
+
+    virtual void Fill(const RectF& r, UiColor color) = 0;
+    virtual void Text(const wchar_t* text, const RectF& r, UiFont font, UiAlign align, UiColor color) = 0;
+    virtual void Icon(const uint8_t* pixels, float x, float y, float size) = 0;
+
+    bool IsVisible(const RectF& r) const {
+        return r.X < dirty_.right && r.X + r.Width > dirty_.left && r.Y < dirty_.bottom && r.Y + r.Height > dirty_.top;
+    }
+
+protected:
+    RECT dirty_ = {};
+};
+
+class GdiPlusCanvas : public UiCanvas {
+public:
+    GdiPlusCanvas() : family_(L"Segoe UI") {
+        for (int i = 0; i < (int)UiFont::Count; ++i)
+            fonts_[i] = std::make_unique<Font>(&family_, UI_FONTS[i].size, UI_FONTS[i].bold ? FontStyleBold : FontStyleRegular, UnitPixel);
+        for (int i = 0; i < (int)UiColor::Count; ++i) brushes_[i] = std::make_unique<SolidBrush>(UI_COLORS[i]);
+        formats_[(int)UiAlign::Center].SetAlignment(StringAlignmentCenter);
+        formats_[(int)UiAlign::Center].SetLineAlignment(StringAlignmentCenter);
+        formats_[(int)UiAlign::Left].SetAlignment(StringAlignmentNear);
+        formats_[(int)UiAlign::LeftMid].SetAlignment(StringAlignmentNear);
+        formats_[(int)UiAlign::LeftMid].SetLineAlignment(StringAlignmentCenter);
+        formats_[(int)UiAlign::RightMid].SetAlignment(StringAlignmentFar);
+        formats_[(int)UiAlign::RightMid].SetLineAlignment(StringAlignmentCenter);
+    }
+    ~GdiPlusCanvas() override { ReleaseSurface(); }
+
+    void Paint(HWND hwnd, HDC hdc, const RECT& dirty) override {
+        if (!dc_) Resize(hwnd);
+        if (!dc_) return;
+        dirty_ = dirty;
+        graphics_->SetClip(Rect(dirty.left, dirty.top, dirty.right - dirty.left, dirty.bottom - dirty.top));
+        RenderUI(*this, width_, height_);
+        BitBlt(hdc, dirty.left, dirty.top, dirty.right - dirty.left, dirty.bottom - dirty.top, dc_, dirty.left, dirty.top, SRCCOPY);
+    }
+
+    void Resize(HWND hwnd) override {
+        RECT rc; GetClientRect(hwnd, &rc);
+        if (dc_ && width_ == rc.right && height_ == rc.bottom) return;
+        ReleaseSurface();
+        if (rc.right <= 0 || rc.bottom <= 0) return;
+        HDC hdc = GetDC(hwnd);
+        dc_ = CreateCompatibleDC(hdc);
+        bitmap_ = CreateCompatibleBitmap(hdc, rc.right, rc.bottom);
+        oldBitmap_ = SelectObject(dc_, bitmap_);
+        width_ = rc.right;
+        height_ = rc.bottom;
+        ReleaseDC(hwnd, hdc);
+        graphics_ = std::make_unique<Graphics>(dc_);
+        graphics_->SetSmoothingMode(SmoothingModeAntiAlias);
+        graphics_->SetTextRenderingHint(TextRenderingHintClearTypeGridFit);
+    }
+
+    void ReleaseSurface() override {
+        graphics_.reset();
+        if (dc_) {
+            SelectObject(dc_, oldBitmap_);
+            DeleteObject(bitmap_);
+            DeleteDC(dc_);
+        }
+        dc_ = NULL; bitmap_ = NULL; oldBitmap_ = NULL; width_ = height_ = 0;
+    }
+
+    void Fill(const RectF& r, UiColor color) override {
+        graphics_->FillRectangle(brushes_[(int)color].get(), r);
+    }
+
+    void Text(const wchar_t* text, const RectF& r, UiFont font, UiAlign align, UiColor color) override {
+        graphics_->DrawString(text, -1, fonts_[(int)font].get(), r, &formats_[(int)align], brushes_[(int)color].get());
+    }
+
+    void Icon(const uint8_t* pixels, float x, float y, float size) override {
+        // Wraps the pixels directly, nothing is copied.
+        Bitmap icon(ICON_DIM, ICON_DIM, ICON_DIM * 4, PixelFormat32bppARGB, const_cast<BYTE*>(pixels));
+        graphics_->DrawImage(&icon, x, y, size, size);
+    }
+
+private:
+    FontFamily family_;
+    std::unique_ptr<Font> fonts_[(int)UiFont::Count];
+    std::unique_ptr<SolidBrush> brushes_[(int)UiColor::Count];
+    StringFormat formats_[(int)UiAlign::Count];
+    HDC dc_ = NULL;
+    HBITMAP bitmap_ = NULL;
+    HGDIOBJ oldBitmap_ = NULL;
+    int width_ = 0, height_ = 0;
+    std::unique_ptr<Graphics> graphics_;
+};
+
+const size_t D2D_ICON_CACHE_LIMIT = 64; // about two pages of rows
+
+class Direct2DCanvas : public UiCanvas {
+public:
+    // Returns nullptr when Direct2D or DirectWrite is unavailable.
+    static std::unique_ptr<Direct2DCanvas> Create() {
+        std::unique_ptr<Direct2DCanvas> canvas(new Direct2DCanvas());
+        if (FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, canvas->factory_.GetAddressOf()))) return nullptr;
+        if (FAILED(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(canvas->dwrite_.GetAddressOf())))) return nullptr;
+        for (int i = 0; i < (int)UiFont::Count; ++i) {
+            if (FAILED(canvas->dwrite_->CreateTextFormat(L"Segoe UI", NULL, UI_FONTS[i].bold ? DWRITE_FONT_WEIGHT_BOLD : DWRITE_FONT_WEIGHT_NORMAL,
+                                                         DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, UI_FONTS[i].size, L"en-us",
+                                                         canvas->formats_[i].GetAddressOf()))) return nullptr;
+        }
+        return canvas;
+    }
+
+    void Paint(HWND hwnd, HDC, const RECT& dirty) override {
+        if (!CreateTarget(hwnd)) return;
+        dirty_ = dirty;
+        D2D1_SIZE_U size = target_->GetPixelSize();
+        target_->BeginDraw();
+        target_->PushAxisAlignedClip(D2D1::RectF((FLOAT)dirty.left, (FLOAT)dirty.top, (FLOAT)dirty.right, (FLOAT)dirty.bottom), D2D1_ANTIALIAS_MODE_ALIASED);
+        ++frame_;
+        RenderUI(*this, (int)size.width, (int)size.height);
+        target_->PopAxisAlignedClip();
+        // Only rows drawn this frame keep their bitmaps once the cache is full.
+        if (icons_.size() > D2D_ICON_CACHE_LIMIT) {
+            for (auto it = icons_.begin(); it != icons_.end();) it = it->second.frame == frame_ ? std::next(it) : icons_.erase(it);
+        }
+        if (target_->EndDraw() == D2DERR_RECREATE_TARGET) {
+            ReleaseSurface();
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+    }
+
+    void Resize(HWND hwnd) override {
+        if (!target_) return;
+        RECT rc; GetClientRect(hwnd, &rc);
+        target_->Resize(D2D1::SizeU(rc.right, rc.bottom));
+    }
+
+    void ReleaseSurface() override {
+        icons_.clear();
+        for (auto& brush : brushes_) brush.Reset();
+        target_.Reset();
+    }
+
+    void Fill(const RectF& r, UiColor color) override {
+        target_->FillRectangle(D2D1::RectF(r.X, r.Y, r.X + r.Width, r.Y + r.Height), brushes_[(int)color].Get());
+    }
+
+    void Text(const wchar_t* text, const RectF& r, UiFont font, UiAlign align, UiColor color) override {
+        IDWriteTextFormat* format = formats_[(int)font].Get();
+        switch (align) {
+        case UiAlign::Center:
+            format->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER);
+            format->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
+            break;
+        case UiAlign::Left:
+            format->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
+            format->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_NEAR);
+            break;
+        case UiAlign::LeftMid:
+            format->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
+            format->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
+            break;
+        default:
+            format->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_TRAILING);
+            format->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
+            break;
+        }
+        target_->DrawText(text, (UINT32)wcslen(text), format, D2D1::RectF(r.X, r.Y, r.X + r.Width, r.Y + r.Height), brushes_[(int)color].Get());
+    }
+
+    void Icon(const uint8_t* pixels, float x, float y, float size) override {
+        // Keyed by pixel address, so any remap or replaced pending icon drops the cache.
+        if (iconGeneration_ != g_IconPixelsGeneration) {
+            icons_.clear();
+            iconGeneration_ = g_IconPixelsGeneration;
+        }
+        auto it = icons_.find(pixels);
+        if (it == icons_.end()) {
+            Microsoft::WRL::ComPtr<ID2D1Bitmap> bitmap;
+            auto props = D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+            if (FAILED(target_->CreateBitmap(D2D1::SizeU(ICON_DIM, ICON_DIM), pixels, ICON_DIM * 4, props, bitmap.GetAddressOf()))) return;
+            it = icons_.emplace(pixels, CachedIcon{std::move(bitmap), 0}).first;
+        }
+        it->second.frame = frame_;
+        target_->DrawBitmap(it->second.bitmap.Get(), D2D1::RectF(x, y, x + size, y + size));
+    }
+
+private:
+    Direct2DCanvas() = default;
+
+    bool CreateTarget(HWND hwnd) {
+        if (target_) return true;
+        RECT rc; GetClientRect(hwnd, &rc);
+        // 96 DPI so DIPs match the pixel layout RenderUI is written in.
+        auto props = D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT, D2D1::PixelFormat(), 96.0f, 96.0f);
+        auto hwndProps = D2D1::HwndRenderTargetProperties(hwnd, D2D1::SizeU(rc.right, rc.bottom), D2D1_PRESENT_OPTIONS_RETAIN_CONTENTS);
+        if (FAILED(factory_->CreateHwndRenderTarget(props, hwndProps, target_.GetAddressOf()))) return false;
+        target_->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_CLEARTYPE);
+        for (int i = 0; i < (int)UiColor::Count; ++i) {
+            const Color& c = UI_COLORS[i];
+            target_->CreateSolidColorBrush(D2D1::ColorF(c.GetR() / 255.0f, c.GetG() / 255.0f, c.GetB() / 255.0f, c.GetA() / 255.0f), brushes_[i].GetAddressOf());
+        }
+        // A fresh target has no retained contents.
+        InvalidateRect(hwnd, NULL, FALSE);
+        return true;
+    }
+
+    Microsoft::WRL::ComPtr<ID2D1Factory> factory_;
+    Microsoft::WRL::ComPtr<IDWriteFactory> dwrite_;
+    Microsoft::WRL::ComPtr<IDWriteTextFormat> formats_[(int)UiFont::Count];
+    Microsoft::WRL::ComPtr<ID2D1HwndRenderTarget> target_;
+    Microsoft::WRL::ComPtr<ID2D1SolidColorBrush> brushes_[(int)UiColor::Count];
+    struct CachedIcon {
+        Microsoft::WRL::ComPtr<ID2D1Bitmap> bitmap;
+        uint64_t frame;
+    };
+    std::unordered_map<const uint8_t*, CachedIcon> icons_;
+    uint32_t iconGeneration_ = 0;
+    uint64_t frame_ = 0;
+};
+
+std::unique_ptr<GdiPlusCanvas> g_GdiCanvas;
+std::unique_ptr<Direct2DCanvas> g_D2DCanvas;
+
+// Brings the configured backend up; falls back to GDI+ if Direct2D fails.
+static void InitUiCanvas() {
+    if (!g_GdiCanvas) g_GdiCanvas = std::make_unique<GdiPlusCanvas>();
+    if (g_UiRenderer == UiRendererKind::Direct2D && !g_D2DCanvas) {
+        g_D2DCanvas = Direct2DCanvas::Create();
+        if (!g_D2DCanvas) g_UiRenderer = UiRendererKind::GdiPlus;
+    }
+    if (g_UiRenderer == UiRendererKind::GdiPlus) g_D2DCanvas.reset();
+}
+
+static UiCanvas* GetActiveCanvas() {
+    // The video core owns the window surface from Load() onwards.
+    if (g_D2DCanvas && g_AppState != AppState::Booting && g_AppState != AppState::Running && g_AppState != AppState::Stopping) return g_D2DCanvas.get();
+    return g_GdiCanvas.get();
+}
+
+static void ReleaseUiCanvas() {
+    g_D2DCanvas.reset();
+    g_GdiCanvas.reset();
+}
+
+// --- ROM Cache ---
+// Packages opened while a title boots or runs are read through an LRU of
+// ROM_BLOCK_SIZE blocks shared by every open package, so the guest's many
+// small reads become a few large ones against the USB drive. A file read
+// sequentially gets the next ROM_PREFETCH_BLOCKS fetched ahead on a small
+// pool. Cached bytes are charged to MemoryCategory::RomCache; under memory
+// pressure the cache shrinks to ROM_CACHE_PRESSURE_BYTES, the newest blocks,
+// and only a hit on the job limit empties it. Reads of ROM_CACHE_BYPASS or
+// more (bulk NCA copies) go straight to the file.
+const size_t ROM_BLOCK_SIZE = 512 * 1024;
+const uint64_t ROM_CACHE_BYTES = 256 * MIB;
+const uint64_t ROM_CACHE_PRESSURE_BYTES = ROM_CACHE_BYTES / 4;
+const int ROM_PREFETCH_BLOCKS = 8;      // 4 MiB ahead
+const int ROM_SEQUENTIAL_RUN = 2;       // contiguous reads before prefetching starts
+const size_t ROM_CACHE_BYPASS = 8 * MIB;
+
+struct RomCacheStats {
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> prefetched = 0;
+    std::atomic<uint64_t> prefetchHits = 0; // demand hits on a block that was prefetched
+    std::atomic<uint64_t> bypassBytes = 0;
+};
+
+RomCacheStats g_RomCacheStats;
+std::atomic<bool> g_RomCacheActive = false; // from StartGame() until the title stops
+std::unique_ptr<WorkerPool> g_RomPrefetchPool; // lives until exit, the core may read until then
+
+class RomBlockCache {
+public:
+    using Block = std::shared_ptr<const std::vector<u8>>;
+
+    // Returns block `index` of `base`, reading it on a miss. A prefetch returns
+    // null instead of waiting for a read someone else has in flight.
+    Block Get(uint32_t file, uint64_t index, const FileSys::VfsFile& base, size_t fileSize, bool prefetch) {
+        uint64_t key = (uint64_t)file << 40 | index;
+        std::unique_lock lock(mutex_);
+        while (true) {
+            if (auto it = map_.find(key); it != map_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                if (!prefetch) {
+                    g_RomCacheStats.hits++;
+                    if (it->second->prefetched) g_RomCacheStats.prefetchHits++;
+                    it->second->prefetched = false;
+                }
+                return it->second->data;
+            }
+            if (!inflight_.count(key)) break;
+            if (prefetch) return nullptr;
+            cv_.wait(lock);
+        }
+        inflight_.insert(key);
+        (prefetch ? g_RomCacheStats.prefetched : g_RomCacheStats.misses)++;
+        lock.unlock();
+
+        uint64_t offset = index * ROM_BLOCK_SIZE;
+        auto data = std::make_shared<std::vector<u8>>(std::min<uint64_t>(ROM_BLOCK_SIZE, fileSize - offset));
+        data->resize(base.Read(data->data(), data->size(), offset));
+
+        lock.lock();
+        inflight_.erase(key);
+        if (!data->empty()) {
+            lru_.push_front({key, data, prefetch});
+            map_[key] = lru_.begin();
+            bytes_ += data->size();
+            ChargeMemory(MemoryCategory::RomCache, (int64_t)data->size());
+            TrimLocked(ROM_CACHE_BYTES);
+        }
+        cv_.notify_all();
+        return data;
+    }
+
+    void Trim(uint64_t target) {
+        std::lock_guard lock(mutex_);
+        TrimLocked(target);
+    }
+
+    uint64_t Bytes() {
+        std::lock_guard lock(mutex_);
+        return bytes_;
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        Block data;
+        bool prefetched;
+    };
+
+    void TrimLocked(uint64_t target) {
+        while (bytes_ > target && !lru_.empty()) {
+            bytes_ -= lru_.back().data->size();
+            ReleaseMemory(MemoryCategory::RomCache, (int64_t)lru_.back().data->size());
+            map_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::list<Entry> lru_;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> map_;
+    std::unordered_set<uint64_t> inflight_;
+    uint64_t bytes_ = 0;
+};
+
+RomBlockCache g_RomCache;
+
+// Read-only view of a package that reads through g_RomCache.
+class CachedRomFile : public FileSys::VfsFile {
+public:
+    CachedRomFile(FileSys::VirtualFile base, uint32_t id) : base_(std::move(base)), id_(id), size_(base_->GetSize()) {}
+
+    std::string GetName() const override { return base_->GetName(); }
+    std::string GetFullPath() const override { return base_->GetFullPath(); }
+    std::size_t GetSize() const override { return size_; }
+    bool Resize(std::size_t) override { return false; }
+    FileSys::VirtualDir GetContainingDirectory() const override { return base_->GetContainingDirectory(); }
+    bool IsWritable() const override { return false; }
+    bool IsReadable() const override { return true; }
+    std::size_t Write(const u8*, std::size_t, std::size_t) override { return 0; }
+    bool Rename(std::string_view) override { return false; }
+
+    std::size_t Read(u8* data, std::size_t length, std::size_t offset) const override {
+        if (offset >= size_) return 0;
+        length = std::min(length, size_ - offset);
+        if (length >= ROM_CACHE_BYPASS) {
+            g_RomCacheStats.bypassBytes += length;
+            return base_->Read(data, length, offset);
+        }
+        QueuePrefetch(offset, length);
+        size_t done = 0;
+        while (done < length) {
+            uint64_t pos = offset + done;
+            auto block = g_RomCache.Get(id_, pos / ROM_BLOCK_SIZE, *base_, size_, false);
+            size_t within = pos % ROM_BLOCK_SIZE;
+            if (!block || within >= block->size()) break;
+            size_t n = std::min(length - done, block->size() - within);
+            memcpy(data + done, block->data() + within, n);
+            done += n;
+        }
+        return done;
+    }
+
+private:
+    void QueuePrefetch(size_t offset, size_t length) const {
+        uint64_t first, last;
+        {
+            std::lock_guard lock(mutex_);
+            bool sequential = offset >= lastEnd_ && offset <= lastEnd_ + ROM_BLOCK_SIZE;
+            run_ = sequential ? run_ + 1 : 0;
+            if (run_ == 0) queuedUpTo_ = 0; // a new run, possibly behind the old one
+            lastEnd_ = offset + length;
+            if (run_ < ROM_SEQUENTIAL_RUN || !g_RomPrefetchPool) return;
+            uint64_t endBlock = (lastEnd_ - 1) / ROM_BLOCK_SIZE;
+            first = std::max(queuedUpTo_, endBlock + 1);
+            last = std::min<uint64_t>(endBlock + ROM_PREFETCH_BLOCKS, (size_ - 1) / ROM_BLOCK_SIZE);
+            if (first > last) return;
+            queuedUpTo_ = last + 1;
+        }
+        for (uint64_t index = first; index <= last; ++index) {
+            // Tasks still queued when the title stops must not refill the cache.
+            g_RomPrefetchPool->Push([base = base_, id = id_, size = size_, index] {
+                if (g_RomCacheActive) g_RomCache.Get(id, index, *base, size, true);
+            });
+        }
+    }
+
+    FileSys::VirtualFile base_;
+    uint32_t id_;
+    size_t size_;
+    mutable std::mutex mutex_; // guards the sequential detector
+    mutable uint64_t lastEnd_ = UINT64_MAX / 2;
+    mutable int run_ = 0;
+    mutable uint64_t queuedUpTo_ = 0;
+};
+
+// --- Compressed Packages ---
+// NSZ and XCZ hold NCZ files in place of NCAs: the NCA's first NCZ_HEADER_SIZE
+// bytes verbatim, then a section table (offset, size, AES-CTR key and
+// counter) and the rest of the NCA decrypted and zstd-compressed, either as
+// independently compressed blocks (NCZBLOCK) or as one solid stream.
+// NczFile rebuilds the original NCA on read by decompressing and
+// re-encrypting; blocks decode in parallel when the ROM cache prefetches
+// them. A package is presented to the core as a PFS0 (an NSP) listing the
+// rebuilt NCAs and the untouched tickets and metadata. For an XCZ that is
+// the secure partition.
+const uint64_t NCZ_HEADER_SIZE = 0x4000;
+const uint64_t NCZ_SOLID_BLOCK = 1 * MIB; // decode granularity of solid streams
+const size_t NCZ_MEMO_BLOCKS = 4;         // decoded blocks kept per file
+const char NCZ_MAGIC_SECTIONS[] = "NCZSECTN"; // compared as 8 raw bytes
+const char NCZ_MAGIC_BLOCKS[] = "NCZBLOCK";
+
+struct NczSection {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t cryptoType; // 3 and 4 are AES-CTR, anything else is stored plain
+    uint64_t padding;
+    uint8_t key[16];
+    uint8_t counter[16];
+};
+static_assert(sizeof(NczSection) == 0x40);
+
+class NczFile : public FileSys::VfsFile {
+public:
+    using Block = std::shared_ptr<const std::vector<u8>>;
+
+    static std::shared_ptr<NczFile> Open(FileSys::VirtualFile ncz, std::string name) {
+        std::shared_ptr<NczFile> f(new NczFile());
+        f->ncz_ = std::move(ncz);
+        f->name_ = std::move(name);
+        f->header_.resize(NCZ_HEADER_SIZE);
+        if (f->ncz_->Read(f->header_.data(), NCZ_HEADER_SIZE, 0) != NCZ_HEADER_SIZE) return nullptr;
+
+        uint64_t pos = NCZ_HEADER_SIZE, count = 0;
+        char magic[8];
+        if (!f->ReadValue(pos, magic) || memcmp(magic, NCZ_MAGIC_SECTIONS, 8) != 0 || !f->ReadValue(pos + 8, count) || count == 0 || count > 64) return nullptr;
+        pos += 16;
+        f->sections_.resize(count);
+        if (f->ncz_->Read(reinterpret_cast<u8*>(f->sections_.data()), count * sizeof(NczSection), pos) != count * sizeof(NczSection)) return nullptr;
+        pos += count * sizeof(NczSection);
+        for (const auto& s : f->sections_) {
+            if (s.offset + s.size < s.offset || s.offset + s.size < NCZ_HEADER_SIZE) return nullptr;
+            f->bodySize_ = std::max(f->bodySize_, s.offset + s.size - NCZ_HEADER_SIZE);
+        }
+
+        if (f->ReadValue(pos, magic) && memcmp(magic, NCZ_MAGIC_BLOCKS, 8) == 0) {
+            uint8_t info[4];
+            uint32_t blocks = 0;
+            uint64_t decompressed = 0;
+            if (f->ncz_->Read(info, 4, pos + 8) != 4 || !f->ReadValue(pos + 12, blocks) || !f->ReadValue(pos + 16, decompressed)) return nullptr;
+            if (info[3] < 14 || info[3] > 32 || blocks == 0) return nullptr; // exponent
+            if (blocks != (decompressed + (1ULL << info[3]) - 1) >> info[3]) return nullptr; // GetBlock indexes blockOffsets_ by it
+            std::vector<uint32_t> sizes(blocks);
+            if (f->ncz_->Read(reinterpret_cast<u8*>(sizes.data()), blocks * 4ULL, pos + 24) != blocks * 4ULL) return nullptr;
+            f->blockSize_ = 1ULL << info[3];
+            f->bodySize_ = decompressed;
+            f->blockOffsets_.resize(blocks + 1);
+            f->blockOffsets_[0] = pos + 24 + blocks * 4ULL;
+            for (uint32_t i = 0; i < blocks; ++i) f->blockOffsets_[i + 1] = f->blockOffsets_[i] + sizes[i];
+        } else {
+            f->blockSize_ = NCZ_SOLID_BLOCK;
+            f->streamStart_ = pos;
+        }
+        return f;
+    }
+
+    ~NczFile() override {
+        if (stream_) ZSTD_freeDStream(stream_);
+    }
+
+    std::string GetName() const override { return name_; }
+    std::size_t GetSize() const override { return NCZ_HEADER_SIZE + bodySize_; }
+    bool Resize(std::size_t) override { return false; }
+    FileSys::VirtualDir GetContainingDirectory() const override { return ncz_->GetContainingDirectory(); }
+    bool IsWritable() const override { return false; }
+    bool IsReadable() const override { return true; }
+    std::size_t Write(const u8*, std::size_t, std::size_t) override { return 0; }
+    bool Rename(std::string_view) override { return false; }
+
+    bool IsSolid() const { return blockOffsets_.empty(); }
+
+    std::size_t Read(u8* data, std::size_t length, std::size_t offset) const override {
+        size_t size = GetSize();
+        if (offset >= size) return 0;
+        length = std::min(length, size - offset);
+        size_t done = 0;
+        if (offset < NCZ_HEADER_SIZE) {
+            done = std::min<size_t>(length, NCZ_HEADER_SIZE - offset);
+            memcpy(data, header_.data() + offset, done);
+        }
+        while (done < length) {
+            uint64_t body = offset + done - NCZ_HEADER_SIZE;
+            Block block = GetBlock(body / blockSize_);
+            size_t within = body % blockSize_;
+            if (!block || within >= block->size()) break;
+            size_t n = std::min(length - done, block->size() - within);
+            memcpy(data + done, block->data() + within, n);
+            done += n;
+        }
+        return done;
+    }
+
+private:
+    NczFile() = default;
+
+    template <typename T>
+    bool ReadValue(uint64_t offset, T& value) const {
+        return ncz_->Read(reinterpret_cast<u8*>(&value), sizeof(T), offset) == sizeof(T);
+    }
+
+    uint64_t BlockLength(uint64_t index) const {
+        return std::min(blockSize_, bodySize_ - index * blockSize_);
+    }
+
+    Block FindMemo(uint64_t index) const {
+        for (const auto& [i, block] : memo_) {
+            if (i == index) return block;
+        }
+        return nullptr;
+    }
+
+    void Remember(uint64_t index, Block block) const {
+        memo_.emplace_front(index, std::move(block));
+        if (memo_.size() > NCZ_MEMO_BLOCKS) memo_.pop_back();
+    }
+
+    Block GetBlock(uint64_t index) const {
+        if (index * blockSize_ >= bodySize_) return nullptr;
+        {
+            std::lock_guard lock(memoMutex_);
+            if (auto block = FindMemo(index)) return block;
+        }
+        if (blockOffsets_.empty()) return DecodeSolid(index);
+
+        // Independent blocks: decoded outside any lock so readers run in parallel.
+        uint64_t compressed = blockOffsets_[index + 1] - blockOffsets_[index];
+        std::vector<u8> in(compressed);
+        if (ncz_->Read(in.data(), compressed, blockOffsets_[index]) != compressed) return nullptr;
+        auto out = std::make_shared<std::vector<u8>>(BlockLength(index));
+        if (compressed == out->size()) {
+            memcpy(out->data(), in.data(), compressed); // stored: compression didn't help
+        } else {
+            size_t r = ZSTD_decompress(out->data(), out->size(), in.data(), in.size());
+            if (ZSTD_isError(r) || r != out->size()) return nullptr;
+        }
+        Encrypt(*out, NCZ_HEADER_SIZE + index * blockSize_);
+        std::lock_guard lock(memoMutex_);
+        Remember(index, out);
+        return out;
+    }
+
+    // Solid streams only decode forward; a read behind the stream restarts it.
+    // zstd can't save a decoder mid-frame, so there are no checkpoints to
+    // resume from: StartGame() warns before booting such a package.
+    Block DecodeSolid(uint64_t index) const {
+        std::lock_guard solidLock(solidMutex_);
+        {
+            std::lock_guard lock(memoMutex_);
+            if (auto block = FindMemo(index)) return block;
+        }
+        if (!stream_ || index < nextSolidBlock_) {
+            if (!stream_) stream_ = ZSTD_createDStream();
+            ZSTD_initDStream(stream_);
+            streamPos_ = streamStart_;
+            inBuffer_.clear();
+            inPos_ = 0;
+            nextSolidBlock_ = 0;
+        }
+        std::vector<u8> chunk(256 * 1024);
+        while (nextSolidBlock_ <= index) {
+            auto out = std::make_shared<std::vector<u8>>(BlockLength(nextSolidBlock_));
+            ZSTD_outBuffer ob = {out->data(), out->size(), 0};
+            while (ob.pos < ob.size) {
+                if (inPos_ == inBuffer_.size()) {
+                    size_t got = ncz_->Read(chunk.data(), chunk.size(), streamPos_);
+                    if (got == 0) return nullptr;
+                    streamPos_ += got;
+                    inBuffer_.assign(chunk.begin(), chunk.begin() + got);
+                    inPos_ = 0;
+                }
+                ZSTD_inBuffer ib = {inBuffer_.data(), inBuffer_.size(), inPos_};
+                if (ZSTD_isError(ZSTD_decompressStream(stream_, &ob, &ib))) return nullptr;
+                inPos_ = ib.pos;
+            }
+            Encrypt(*out, NCZ_HEADER_SIZE + nextSolidBlock_ * blockSize_);
+            std::lock_guard lock(memoMutex_);
+            Remember(nextSolidBlock_++, out);
+        }
+        std::lock_guard lock(memoMutex_);
+        return FindMemo(index);
+    }
+
+    // Applies each overlapping CTR section's keystream to `buf`, which starts
+    // at NCA offset `ncaOffset`.
+    void Encrypt(std::vector<u8>& buf, uint64_t ncaOffset) const {
+        for (const auto& s : sections_) {
+            if (s.cryptoType != 3 && s.cryptoType != 4) continue;
+            uint64_t begin = std::max(ncaOffset, s.offset), end = std::min(ncaOffset + buf.size(), s.offset + s.size);
+            if (begin >= end) continue;
+            mbedtls_aes_context aes;
+            mbedtls_aes_init(&aes);
+            mbedtls_aes_setkey_enc(&aes, s.key, 128);
+            uint8_t counter[16], stream[16];
+            memcpy(counter, s.counter, 8);
+            uint64_t blockIndex = begin >> 4;
+            for (int i = 0; i < 8; ++i) counter[15 - i] = (uint8_t)(blockIndex >> (i * 8));
+            size_t streamOffset = begin & 15;
+            if (streamOffset) {
+                // Start mid-block: keystream of the current counter, then move past it.
+                mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, counter, stream);
+                for (int i = 15; i >= 8 && ++counter[i] == 0; --i) {}
+            }
+            u8* p = buf.data() + (begin - ncaOffset);
+            mbedtls_aes_crypt_ctr(&aes, end - begin, &streamOffset, counter, stream, p, p);
+            mbedtls_aes_free(&aes);
+        }
+    }
+
+    FileSys::VirtualFile ncz_;
+    std::string name_;
+    std::vector<u8> header_;
+    std::vector<NczSection> sections_;
+    uint64_t bodySize_ = 0;
+    uint64_t blockSize_ = 0;
+    std::vector<uint64_t> blockOffsets_; // block mode: compressed start of each block, plus the end
+    uint64_t streamStart_ = 0;           // solid mode
+
+    mutable std::mutex memoMutex_;
+    mutable std::list<std::pair<uint64_t, Block>> memo_;
+    mutable std::mutex solidMutex_; // guards the stream state below
+    mutable ZSTD_DStream* stream_ = nullptr;
+    mutable uint64_t streamPos_ = 0;
+    mutable std::vector<u8> inBuffer_;
+    mutable size_t inPos_ = 0;
+    mutable uint64_t nextSolidBlock_ = 0;
+};
+
+#ifndef NDEBUG
+// Debug builds decode a small NCZ built in memory, in block and solid layout,
+// and compare the result with the NCA it was made from. The body holds one
+// compressible block, one stored block and a short tail. The first encrypted
+// bytes are checked against AES-128-CTR output computed with OpenSSL.
+static bool CheckNczDecode() {
+    const uint64_t blockSize = 0x4000, bodySize = 2 * blockSize + 0x123;
+    const u8 knownCipher[16] = {0xe5, 0xed, 0x2f, 0x84, 0x2c, 0x0b, 0x65, 0xc9, 0x9a, 0xd8, 0xd3, 0x0e, 0xb2, 0x4b, 0x20, 0x2e};
+
+    std::vector<u8> plain(bodySize);
+    uint32_t noise = 1;
+    for (uint64_t i = 0; i < bodySize; ++i) {
+        noise = noise * 1664525 + 1013904223;
+        plain[i] = i / blockSize == 1 ? (u8)(noise >> 24) : (u8)(i * 7);
+    }
+    NczSection section = {NCZ_HEADER_SIZE, bodySize, 3, 0, {}, {}};
+    for (int i = 0; i < 16; ++i) section.key[i] = (u8)i;
+    for (int i = 0; i < 8; ++i) section.counter[i] = (u8)(0x10 + i);
+
+    // Expected NCA: a patterned header, then the body encrypted in one pass.
+    std::vector<u8> nca(NCZ_HEADER_SIZE + bodySize);
+    for (uint64_t i = 0; i < NCZ_HEADER_SIZE; ++i) nca[i] = (u8)(i ^ 0xA5);
+    uint8_t counter[16] = {}, stream[16];
+    memcpy(counter, section.counter, 8);
+    counter[14] = (u8)(NCZ_HEADER_SIZE >> 12); // NCA offset / 16, big-endian
+    size_t streamOffset = 0;
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, section.key, 128);
+    mbedtls_aes_crypt_ctr(&aes, bodySize, &streamOffset, counter, stream, plain.data(), nca.data() + NCZ_HEADER_SIZE);
+    mbedtls_aes_free(&aes);
+    if (memcmp(nca.data() + NCZ_HEADER_SIZE, knownCipher, 16) != 0) return false;
+
+    auto build = [&](bool blocks) {
+        std::vector<u8> out(nca.begin(), nca.begin() + NCZ_HEADER_SIZE);
+        auto put = [&out](const void* p, size_t n) { out.insert(out.end(), (const u8*)p, (const u8*)p + n); };
+        auto compress = [](const u8* src, size_t n) {
+            std::vector<u8> z(ZSTD_compressBound(n));
+            z.resize(ZSTD_compress(z.data(), z.size(), src, n, 1));
+            if (z.size() >= n) z.assign(src, src + n); // stored
+            return z;
+        };
+        uint64_t count = 1;
+        put(NCZ_MAGIC_SECTIONS, 8);
+        put(&count, 8);
+        put(&section, sizeof(section));
+        if (!blocks) {
+            auto z = compress(plain.data(), bodySize);
+            put(z.data(), z.size());
+            return out;
+        }
+        const uint8_t info[4] = {2, 1, 0, 14}; // version, type, unused, block size exponent
+        uint32_t n = (uint32_t)((bodySize + blockSize - 1) / blockSize);
+        put(NCZ_MAGIC_BLOCKS, 8);
+        put(info, 4);
+        put(&n, 4);
+        put(&bodySize, 8);
+        std::vector<std::vector<u8>> packed;
+        for (uint32_t i = 0; i < n; ++i) packed.push_back(compress(plain.data() + i * blockSize, std::min(blockSize, bodySize - i * blockSize)));
+        for (const auto& z : packed) {
+            uint32_t size = (uint32_t)z.size();
+            put(&size, 4);
+        }
+        for (const auto& z : packed) put(z.data(), z.size());
+        return out;
+    };
+
+    for (bool blocks : {true, false}) {
+        auto file = NczFile::Open(std::make_shared<FileSys::VectorVfsFile>(build(blocks), "check.ncz"), "check.nca");
+        if (!file || file->GetSize() != nca.size()) return false;
+        // Odd-sized reads cross the header and block boundaries mid-way.
+        std::vector<u8> got(nca.size());
+        for (size_t pos = 0; pos < got.size(); pos += 0x1001) {
+            size_t n = std::min<size_t>(0x1001, got.size() - pos);
+            if (file->Read(got.data() + pos, n, pos) != n) return false;
+        }
+        if (got != nca) return false;
+    }
+    return true;
+}
+#endif
+
+// A PFS0 image built in memory over a list of files.
+class PackageView : public FileSys::VfsFile {
+public:
+    PackageView(std::string name, std::vector<FileSys::VirtualFile> files) : name_(std::move(name)), files_(std::move(files)) {
+        std::string strings;
+        std::vector<uint32_t> nameOffsets;
+        for (const auto& f : files_) {
+            nameOffsets.push_back((uint32_t)strings.size());
+            strings += f->GetName();
+            strings += '\0';
+        }
+        size_t headerSize = 16 + files_.size() * 24 + strings.size();
+        strings.resize(strings.size() + (0x20 - headerSize % 0x20) % 0x20, '\0');
+        header_.resize(16 + files_.size() * 24);
+        auto put32 = [&](size_t at, uint32_t v) { memcpy(header_.data() + at, &v, 4); };
+        auto put64 = [&](size_t at, uint64_t v) { memcpy(header_.data() + at, &v, 8); };
+        memcpy(header_.data(), "PFS0", 4);
+        put32(4, (uint32_t)files_.size());
+        put32(8, (uint32_t)strings.size());
+        uint64_t offset = 0;
+        for (size_t i = 0; i < files_.size(); ++i) {
+            starts_.push_back(offset);
+            put64(16 + i * 24, offset);
+            put64(24 + i * 24, files_[i]->GetSize());
+            put32(32 + i * 24, nameOffsets[i]);
+            offset += files_[i]->GetSize();
+        }
+        header_.insert(header_.end(), strings.begin(), strings.end());
+        size_ = header_.size() + offset;
+    }
+
+    std::string GetName() const override { return name_; }
+    std::size_t GetSize() const override { return size_; }
+    bool Resize(std::size_t) override { return false; }
+    FileSys::VirtualDir GetContainingDirectory() const override { return nullptr; }
+    bool IsWritable() const override { return false; }
+    bool IsReadable() const override { return true; }
+    std::size_t Write(const u8*, std::size_t, std::size_t) override { return 0; }
+    bool Rename(std::string_view) override { return false; }
+
+    std::size_t Read(u8* data, std::size_t length, std::size_t offset) const override {
+        if (offset >= size_) return 0;
+        length = std::min(length, size_ - offset);
+        size_t done = 0;
+        if (offset < header_.size()) {
+            done = std::min(length, header_.size() - offset);
+            memcpy(data, header_.data() + offset, done);
+        }
+        while (done < length) {
+            uint64_t pos = offset + done - header_.size();
+            size_t i = std::upper_bound(starts_.begin(), starts_.end(), pos) - starts_.begin() - 1;
+            uint64_t within = pos - starts_[i];
+            size_t n = std::min<uint64_t>(length - done, files_[i]->GetSize() - within);
+            if (n == 0 || files_[i]->Read(data + done, n, within) != n) break;
+            done += n;
+        }
+        return done;
+    }
+
+private:
+    std::string name_;
+    std::vector<FileSys::VirtualFile> files_;
+    std::vector<uint64_t> starts_; // data offset of each file
+    std::vector<u8> header_;
+    size_t size_ = 0;
+};
+
+// Returns the package as an NSP with every NCZ rebuilt, or null when it isn't
+// a readable NSZ/XCZ. `wrap` is applied to each rebuilt NCA.
+static FileSys::VirtualFile OpenCompressedPackage(FileSys::VirtualFile file, bool card,
+                                                  const std::function<FileSys::VirtualFile(FileSys::VirtualFile)>& wrap) {
+    std::shared_ptr<FileSys::PartitionFilesystem> pfs;
+    if (card) {
+        // XCI header: offset of the root HFS0 at 0x130, whose "secure" entry holds the content.
+        uint64_t rootOffset = 0;
+        if (file->Read(reinterpret_cast<u8*>(&rootOffset), 8, 0x130) != 8 || rootOffset >= file->GetSize()) return nullptr;
+        FileSys::PartitionFilesystem root(std::make_shared<FileSys::OffsetVfsFile>(file, file->GetSize() - rootOffset, rootOffset));
+        auto secure = root.GetStatus() == Loader::ResultStatus::Success ? root.GetFile("secure") : nullptr;
+        if (!secure) return nullptr;
+        pfs = std::make_shared<FileSys::PartitionFilesystem>(secure);
+    } else {
+        pfs = std::make_shared<FileSys::PartitionFilesystem>(file);
+    }
+    if (pfs->GetStatus() != Loader::ResultStatus::Success) return nullptr;
+
+    std::vector<FileSys::VirtualFile> files;
+    for (auto& f : pfs->GetFiles()) {
+        std::string name = f->GetName();
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ncz") == 0) {
+            auto nca = NczFile::Open(f, name.substr(0, name.size() - 4) + ".nca");
+            if (!nca) return nullptr;
+            files.push_back(wrap(std::move(nca)));
+        } else {
+            files.push_back(f);
+        }
+    }
+    std::string name = file->GetName();
+    return std::make_shared<PackageView>(name.substr(0, name.find_last_of('.')) + ".nsp", std::move(files));
+}
+
+// True when an NCZ in the NSZ/XCZ at `path` is one solid stream. Installs read
+// those front to back, but a running title's RomFS reads jump around and
+// each jump backwards decodes the NCA again from its start.
+static bool IsSolidCompressedPackage(const std::filesystem::path& path) {
+    std::wstring ext = path.extension().wstring();
+    bool card = _wcsicmp(ext.c_str(), L".xcz") == 0;
+    if (!card && _wcsicmp(ext.c_str(), L".nsz") != 0) return false;
+    auto file = FileSys::RealVfsFilesystem().OpenFile(WideToUtf8(path.wstring()), FileSys::OpenMode::Read);
+    if (!file) return false;
+    bool solid = false;
+    OpenCompressedPackage(std::move(file), card, [&](FileSys::VirtualFile nca) {
+        solid = solid || std::static_pointer_cast<NczFile>(nca)->IsSolid();
+        return nca;
+    });
+    return solid;
+}
+
+// The core's filesystem: RealVfsFilesystem, except for packages opened for
+// reading. NSZ/XCZ always come back as a rebuilt NSP; while g_RomCacheActive
+// packages (for compressed ones, each rebuilt NCA) are wrapped in a
+// CachedRomFile. Each path gets one cache id, so reopening a package finds
+// its blocks again.
+class CachingVfsFilesystem : public FileSys::RealVfsFilesystem {
+public:
+    FileSys::VirtualFile OpenFile(std::string_view path, FileSys::OpenMode perms) override {
+        auto file = RealVfsFilesystem::OpenFile(path, perms);
+        if (!file || perms != FileSys::OpenMode::Read || path.size() < 4) return file;
+        std::string ext(path.substr(path.size() - 4));
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+        bool cache = g_RomCacheActive;
+        if (ext == ".nsz" || ext == ".xcz") {
+            std::string key(path);
+            return OpenCompressedPackage(std::move(file), ext == ".xcz", [&](FileSys::VirtualFile nca) -> FileSys::VirtualFile {
+                if (!cache) return nca;
+                uint32_t id = GetCacheId(key + "/" + nca->GetName());
+                return std::make_shared<CachedRomFile>(std::move(nca), id);
+            });
+        }
+        if (!cache || (ext != ".nsp" && ext != ".xci")) return file;
+        return std::make_shared<CachedRomFile>(std::move(file), GetCacheId(std::string(path)));
+    }
+
+private:
+    uint32_t GetCacheId(const std::string& key) {
+        std::lock_guard lock(mutex_);
+        return ids_.try_emplace(key, (uint32_t)ids_.size() + 1).first->second;
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, uint32_t> ids_;
+};
+
+static double GetRomCacheHitRate() {
+    uint64_t hits = g_RomCacheStats.hits, misses = g_RomCacheStats.misses;
+    return hits + misses ? hits * 100.0 / (hits + misses) : 0.0;
+}
+
+// Called from StartGame(); the counters cover one title.
+static void ActivateRomCache() {
+    g_RomCacheStats.hits = g_RomCacheStats.misses = g_RomCacheStats.prefetched = 0;
+    g_RomCacheStats.prefetchHits = g_RomCacheStats.bypassBytes = 0;
+    g_RomCacheActive = true;
+}
+
+static void DeactivateRomCache() {
+    g_RomCacheActive = false;
+    g_RomCache.Trim(0);
+}
+
+// Creates the shared Core::System with its content provider and filesystem.
+// Metadata workers open ROMs through it before any title is booted.
+static void EnsureSystem() {
+    if (g_System) return;
+    g_System = std::make_unique<Core::System>();
+    g_System->SetContentProvider(std::make_unique<FileSys::ContentProviderUnion>());
+    g_System->SetFilesystem(std::make_shared<CachingVfsFilesystem>());
+    // Also decodes compressed packages ahead of the reader, so a few threads.
+    g_RomPrefetchPool = std::make_unique<WorkerPool>(std::clamp(std::thread::hardware_concurrency() / 4, 2u, 4u), THREAD_PRIORITY_BELOW_NORMAL, L"CitronRomPrefetch");
+    RegisterMemoryTrimmer(MemoryCategory::RomCache, [](bool hard) { g_RomCache.Trim(hard ? 0 : ROM_CACHE_PRESSURE_BYTES); });
+}
+
+struct BootError {
+    std::wstring title;
+    std::wstring message;
+    UINT flags;
+};
+
+// --- Firmware Manifest ---
+// What boot needs to know about keys and firmware, probed once and kept in
+// firmware.manifest: key presence, registered NCA count and the firmware
+// version read from the system version archive. Two stats at startup detect
+// files copied in behind our back; installs rebuild it explicitly. The last
+// line is an FNV-1a checksum of everything before it.
+struct FirmwareManifest {
+    bool hasKeys = false;
+    uint64_t keysSize = 0;
+    int64_t keysMtime = 0;
+    uint32_t ncaCount = 0;
+    int64_t nandMtime = 0;
+    std::string version; // display version, empty until a warm-up has read it
+};
+
+std::mutex g_ManifestMutex;
+FirmwareManifest g_Manifest;
+const uint64_t SYSTEM_VERSION_TITLE_ID = 0x0100000000000809;
+
+static std::filesystem::path GetKeysPath() { return GetUserDirectory() / "keys/prod.keys"; }
+static std::filesystem::path GetRegisteredPath() { return GetUserDirectory() / "nand/system/Contents/registered"; }
+static std::filesystem::path GetManifestPath() { return GetUserDirectory() / "firmware.manifest"; }
+
+static uint64_t Fnv1a(const std::string& data) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (unsigned char c : data) { h ^= c; h *= 0x100000001B3ULL; }
+    return h;
+}
+
+// The cheap part of the probe: just enough to tell whether the manifest is current.
+static void StatFirmwareManifest(FirmwareManifest& m) {
+    std::error_code ec;
+    auto keyPath = GetKeysPath();
+    m.hasKeys = fs::is_regular_file(keyPath, ec);
+    m.keysSize = m.hasKeys ? fs::file_size(keyPath, ec) : 0;
+    m.keysMtime = m.hasKeys ? fs::last_write_time(keyPath, ec).time_since_epoch().count() : 0;
+    m.nandMtime = fs::last_write_time(GetRegisteredPath(), ec).time_since_epoch().count();
+    if (ec) m.nandMtime = 0;
+}
+
+static void WriteFirmwareManifest(const FirmwareManifest& m) {
+    std::string body = fmt::format("HasKeys={}\nKeysSize={}\nKeysTime={}\nNcaCount={}\nNandTime={}\nVersion={}\n",
+        m.hasKeys ? 1 : 0, m.keysSize, m.keysMtime, m.ncaCount, m.nandMtime, m.version);
+    body += fmt::format("Checksum={:016X}\n", Fnv1a(body));
+
+    auto path = GetManifestPath();
+    auto tmp = path; tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return;
+        out << body;
+        if (!out) return;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+}
+
+static bool ReadFirmwareManifest(FirmwareManifest& m) {
+    std::ifstream in(GetManifestPath(), std::ios::binary);
+    if (!in.is_open()) return false;
+    std::string body, line;
+    uint64_t checksum = 0;
+    bool haveChecksum = false;
+    while (std::getline(in, line)) {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = line.substr(0, eq), val = line.substr(eq + 1);
+        if (key == "Checksum") { checksum = std::strtoull(val.c_str(), nullptr, 16); haveChecksum = true; break; }
+        body += line + "\n";
+        if (key == "HasKeys") m.hasKeys = val == "1";
+        else if (key == "KeysSize") m.keysSize = std::strtoull(val.c_str(), nullptr, 10);
+        else if (key == "KeysTime") m.keysMtime = std::strtoll(val.c_str(), nullptr, 10);
+        else if (key == "NcaCount") m.ncaCount = (uint32_t)std::strtoul(val.c_str(), nullptr, 10);
+        else if (key == "NandTime") m.nandMtime = std::strtoll(val.c_str(), nullptr, 10);
+        else if (key == "Version") m.version = val;
+    }
+    return haveChecksum && checksum == Fnv1a(body);
+}
+
+// Full probe; runs at startup only when the manifest is missing, corrupt or stale.
+static void RebuildFirmwareManifest() {
+    FirmwareManifest m;
+    StatFirmwareManifest(m);
+    std::error_code ec;
+    for (fs::directory_iterator it(GetRegisteredPath(), ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        if (it->path().extension() == ".nca") ++m.ncaCount;
+    }
+    std::lock_guard lock(g_ManifestMutex);
+    // A freshly probed folder with the same NCAs keeps the version read earlier.
+    if (m.ncaCount == g_Manifest.ncaCount && m.nandMtime == g_Manifest.nandMtime) m.version = g_Manifest.version;
+    g_Manifest = m;
+    WriteFirmwareManifest(g_Manifest);
+}
+
+static void LoadFirmwareManifest() {
+    FirmwareManifest stored, current;
+    bool valid = ReadFirmwareManifest(stored);
+    StatFirmwareManifest(current);
+    if (valid && stored.hasKeys == current.hasKeys && stored.keysSize == current.keysSize &&
+        stored.keysMtime == current.keysMtime && stored.nandMtime == current.nandMtime) {
+        std::lock_guard lock(g_ManifestMutex);
+        g_Manifest = stored;
+        return;
+    }
+    RebuildFirmwareManifest();
+}
+
+static FirmwareManifest GetFirmwareManifest() {
+    std::lock_guard lock(g_ManifestMutex);
+    return g_Manifest;
+}
+
+// Reads the display version out of the system version archive; needs the
+// content factories registered, so the warm-up calls it.
+static void UpdateFirmwareVersion() {
+    auto nca = g_System->GetContentProvider().GetEntry(SYSTEM_VERSION_TITLE_ID, FileSys::ContentRecordType::Data);
+    if (!nca || !nca->GetRomFS()) return;
+    auto romfs = FileSys::ExtractRomFS(nca->GetRomFS());
+    auto file = romfs ? romfs->GetFile("file") : nullptr;
+    if (!file) return;
+    char display[0x18] = {};
+    if (file->Read(reinterpret_cast<u8*>(display), sizeof(display) - 1, 0x68) == 0) return;
+
+    std::lock_guard lock(g_ManifestMutex);
+    if (g_Manifest.version == display) return;
+    g_Manifest.version = display;
+    WriteFirmwareManifest(g_Manifest);
+}
+
+// --- Warm System ---
+// Everything up to the title-specific Load() is prepared in the background as
+// soon as keys and firmware are present: keys parsed, System::Initialize(),
+// and the NAND/SD content factories registered. Boot then only waits for the
+// warm-up if it is still running. Load() re-initializes by itself should the
+// core settings have changed since.
+std::mutex g_WarmMutex;        // held for the whole warm-up, boot blocks on it
+bool g_SystemInitialized = false;
+bool g_SystemWarm = false;
+bool g_KeysStale = false;      // keys or firmware were installed after the last warm-up
+
+static void ApplyCoreConfiguration() {
+    Settings::values.renderer_backend.SetValue(Settings::RendererBackend::D3D12);
+    Settings::values.use_disk_shader_cache.SetValue(true);
+    Settings::values.use_asynchronous_gpu_emulation.SetValue(true);
+}
+
+// Returns the message to show when a title can't be booted yet, null when fine.
+// Answered from the manifest, so it costs no disk access.
+static std::unique_ptr<BootError> CheckBootPrerequisites() {
+    FirmwareManifest m = GetFirmwareManifest();
+
+    // 1. Check for Keys (UI Check)
+    if (!m.hasKeys) {
+        std::wstring msg = L"prod.keys MISSING!\nLocation:\n" + GetKeysPath().wstring() + L"\n\nPlease use Settings > Install Prod Keys";
+        return std::make_unique<BootError>(BootError{L"Missing Files", msg, MB_ICONERROR});
+    }
+
+    // 2. Check for Firmware (UI Check)
+    if (m.ncaCount == 0) {
+        std::wstring msg = L"Firmware MISSING!\nLocation:\n" + GetRegisteredPath().wstring() + L"\n\nFolder must contain .nca files.\nPlease use Settings > Install Firmware";
+        return std::make_unique<BootError>(BootError{L"Missing Files", msg, MB_ICONERROR});
+    }
+    return nullptr;
+}
+
+static void WarmSystem() {
+    std::lock_guard lock(g_WarmMutex);
+    if (g_SystemWarm) return;
+
+    ApplyCoreConfiguration();
+    auto& keys = Core::Crypto::KeyManager::Instance();
+    if (g_KeysStale) keys.ReloadKeys();
+
+    // Metadata workers share g_System; keep them out while it is being set up.
+    std::unique_lock loaderLock(g_LoaderMutex);
+    if (!g_SystemInitialized) {
+        g_System->Initialize();
+        g_SystemInitialized = true;
+    }
+    g_System->GetFileSystemController().CreateFactories(*g_System->GetFilesystem());
+    if (!g_InputSubsystem) {
+        g_InputSubsystem = std::make_unique<InputCommon::InputSubsystem>();
+        g_InputSubsystem->Initialize();
+    }
+    UpdateFirmwareVersion();
+    g_KeysStale = false;
+    g_SystemWarm = true;
+}
+
+static void WarmupThread() {
+    TRACE_THREAD_NAME("Warmup");
+    TRACE_SCOPE("WarmSystem");
+    if (CheckBootPrerequisites()) return;
+    try { WarmSystem(); } catch (...) {}
+}
+
+// Called at startup and after every install; cheap when already warm.
+static void StartWarmup(bool contentChanged) {
+    if (contentChanged) {
+        std::lock_guard lock(g_WarmMutex);
+        g_SystemWarm = false;
+        g_KeysStale = true;
+    }
+    std::thread(WarmupThread).detach();
+}
+
+// --- Package Install ---
+// Updates and DLC are installed with RegisteredCache::InstallEntry straight
+// out of the NSP/XCI. The copy callback streams each NCA in large blocks:
+// while one block is being written to NAND the next is read from the
+// package and fed to SHA-256, and the digest is checked against the content
+// ID the NCA is named after once the last block is in. Nothing is extracted
+// to temporary storage first.
+const size_t PACKAGE_COPY_BLOCK = 16 * 1024 * 1024;
+
+struct PackageCopyState {
+    std::atomic<bool> hashMismatch = false;
+    std::string mismatchName;
+};
+
+PackageCopyState g_PackageCopy; // one install at a time, guarded by g_IsInstalling
+
+static bool ParseNcaId(const std::string& name, std::array<uint8_t, 16>& id) {
+    if (name.size() < 32) return false;
+    for (size_t i = 0; i < 16; ++i) {
+        auto nibble = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            c = (char)tolower(c);
+            return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        };
+        int hi = nibble(name[i * 2]), lo = nibble(name[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return false;
+        id[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+static bool StreamPackageNca(const FileSys::VirtualFile& src, const FileSys::VirtualFile& dest, size_t) {
+    if (!src || !dest) return false;
+    const size_t size = src->GetSize();
+    if (!dest->Resize(size)) return false;
+
+    std::array<uint8_t, 16> expected{};
+    bool verify = ParseNcaId(dest->GetName(), expected);
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+
+    std::vector<uint8_t> buffers[2] = {std::vector<uint8_t>(PACKAGE_COPY_BLOCK), std::vector<uint8_t>(PACKAGE_COPY_BLOCK)};
+    std::future<bool> writing;
+    bool ok = true;
+    for (size_t offset = 0, block = 0; ok && offset < size; ++block) {
+        auto& buffer = buffers[block & 1];
+        size_t n = src->Read(buffer.data(), std::min(PACKAGE_COPY_BLOCK, size - offset), offset);
+        if (n == 0) { ok = false; break; }
+        mbedtls_sha256_update_ret(&sha, buffer.data(), n);
+        if (writing.valid() && !writing.get()) { ok = false; break; }
+        writing = std::async(std::launch::async, [&dest, data = buffer.data(), n, offset] { return dest->Write(data, n, offset) == n; });
+        offset += n;
+        g_InstallProgress.bytesDone += n;
+        g_InstallProgress.bytesCopied += n;
+    }
+    if (writing.valid() && !writing.get()) ok = false;
+
+    std::array<uint8_t, 32> digest{};
+    mbedtls_sha256_finish_ret(&sha, digest.data());
+    mbedtls_sha256_free(&sha);
+    if (ok && verify && memcmp(digest.data(), expected.data(), expected.size()) != 0) {
+        g_PackageCopy.mismatchName = dest->GetName();
+        g_PackageCopy.hashMismatch = true;
+        ok = false;
+    }
+    if (!ok) dest->Resize(0);
+    return ok;
+}
+
+static std::wstring DescribeInstallResult(FileSys::InstallResult result) {
+    switch (result) {
+    case FileSys::InstallResult::Success: return L"installed";
+    case FileSys::InstallResult::OverwriteExisting: return L"installed (replaced existing)";
+    case FileSys::InstallResult::ErrorAlreadyExists: return L"already installed";
+    case FileSys::InstallResult::ErrorCopyFailed: return L"copy failed";
+    case FileSys::InstallResult::ErrorMetaFailed: return L"metadata could not be read";
+    case FileSys::InstallResult::ErrorBaseInstall: return L"is a base game, not an update or DLC";
+    default: return L"failed";
+    }
+}
+
+static void InstallPackagesThread(HWND hwnd, std::vector<std::filesystem::path> packages, bool isXci) {
+    TRACE_THREAD_NAME("Install");
+    TRACE_SCOPE("InstallPackagesThread");
+    auto result = std::make_unique<InstallResult>();
+    result->ok = true;
+
+    if (auto error = CheckBootPrerequisites()) {
+        result->ok = false;
+        result->message = error->message;
+    } else {
+        // Without a warmed system nothing below can install; say why instead
+        // of failing every package with a meta error.
+        try {
+            WarmSystem();
+        } catch (const std::exception& e) {
+            result->ok = false;
+            result->message = L"Couldn't initialize the system: " + Utf8ToWide(e.what());
+        } catch (...) {
+            result->ok = false;
+            result->message = L"Couldn't initialize the system.";
+        }
+    }
+    if (result->ok) {
+        uint64_t total = 0;
+        std::error_code ec;
+        for (const auto& p : packages) total += fs::file_size(p, ec);
+        g_InstallProgress.bytesTotal = total;
+        g_InstallProgress.filesTotal = (uint32_t)packages.size();
+        g_InstallProgress.startTick = GetTickCount64();
+
+        for (const auto& path : packages) {
+            SetInstallPhase(L"Installing " + path.filename().wstring() + L"...");
+            g_PackageCopy.hashMismatch = false;
+            auto file = g_System->GetFilesystem()->OpenFile(WideToUtf8(path.wstring()), FileSys::OpenMode::Read);
+            FileSys::InstallResult status = FileSys::InstallResult::ErrorMetaFailed;
+            if (file) {
+                // InstallEntry refreshes the registered cache the metadata workers read through.
+                std::unique_lock loaderLock(g_LoaderMutex);
+                auto* nand = g_System->GetFileSystemController().GetUserNANDContents();
+                // An XCZ opens as the NSP rebuilt from its secure partition.
+                if (isXci && _wcsicmp(path.extension().c_str(), L".xcz") != 0) {
+                    FileSys::XCI xci(file);
+                    if (xci.GetStatus() == Loader::ResultStatus::Success) status = nand->InstallEntry(xci, true, StreamPackageNca);
+                } else {
+                    FileSys::NSP nsp(file);
+                    if (nsp.GetStatus() == Loader::ResultStatus::Success && !nsp.IsExtractedType()) status = nand->InstallEntry(nsp, true, StreamPackageNca);
+                }
+            }
+            std::wstring line = path.filename().wstring() + L": ";
+            if (g_PackageCopy.hashMismatch) line += L"verification failed (" + Utf8ToWide(g_PackageCopy.mismatchName) + L" is corrupt)";
+            else line += DescribeInstallResult(status);
+            bool installed = status == FileSys::InstallResult::Success || status == FileSys::InstallResult::OverwriteExisting;
+            if (installed) result->copied++;
+            else if (status == FileSys::InstallResult::ErrorAlreadyExists) result->skipped++;
+            else result->ok = false;
+            result->message += line + L"\n";
+            g_InstallProgress.filesDone++;
+        }
+        SetInstallPhase(result->ok ? L"Done!" : L"Error!");
+    }
+    if (PostMessageW(hwnd, WM_APP_INSTALL_DONE, 0, (LPARAM)result.get())) result.release();
+}
+
+static void InstallPackages(HWND hwnd, bool isXci) {
+    if (g_IsInstalling) return;
+    IFileOpenDialog* pFileOpen;
+    if (FAILED(CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL, IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileOpen)))) return;
+    COMDLG_FILTERSPEC filter = isXci ? COMDLG_FILTERSPEC{L"Game Cards (*.xci, *.xcz)", L"*.xci;*.xcz"}
+                                       : COMDLG_FILTERSPEC{L"Packages (*.nsp, *.nsz)", L"*.nsp;*.nsz"};
+    pFileOpen->SetTitle(isXci ? L"Select XCI Files" : L"Select NSP Files");
+    pFileOpen->SetFileTypes(1, &filter);
+    pFileOpen->SetOptions(FOS_ALLOWMULTISELECT | FOS_FILEMUSTEXIST | FOS_FORCEFILESYSTEM);
+    std::vector<std::filesystem::path> packages;
+    IShellItemArray* items;
+    if (SUCCEEDED(pFileOpen->Show(hwnd)) && SUCCEEDED(pFileOpen->GetResults(&items))) {
+        DWORD count = 0;
+        items->GetCount(&count);
+        for (DWORD i = 0; i < count; ++i) {
+            IShellItem* pItem;
+            PWSTR pszFilePath;
+            if (FAILED(items->GetItemAt(i, &pItem))) continue;
+            if (SUCCEEDED(pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath))) {
+                packages.emplace_back(pszFilePath);
+                CoTaskMemFree(pszFilePath);
+            }
+            pItem->Release();
+        }
+        items->Release();
+    }
+    pFileOpen->Release();
+    if (packages.empty()) return;
+
+    EnsureSystem();
+    auto& p = g_InstallProgress;
+    p.bytesTotal = p.bytesDone = p.bytesCopied = 0;
+    p.filesTotal = p.filesDone = p.filesSkipped = 0;
+    SetInstallPhase(L"Starting...");
+    g_IsInstalling = true;
+    SetTimer(hwnd, INSTALL_REFRESH_TIMER, 250, NULL);
+    InvalidateRect(hwnd, NULL, FALSE);
+    std::thread(InstallPackagesThread, hwnd, std::move(packages), isXci).detach();
+}
+
+// --- Title Profiles ---
+// Per-title overrides stored as user/config/custom/<title id>.ini, the same
+// place the core's own per-game configs live. Every field is either -1
+// (follow the global setting) or an index into its option list. At boot the
+// overrides are written into the switchable settings' custom slots, which
+// Settings::RestoreGlobalState() drops again.
+enum class ProfileField { CpuAccuracy, MultiCore, Resolution, AsyncShaders, MemoryLayout, TargetFps, ResolutionMin, ResolutionMax, Count };
+const int PROFILE_FIELD_COUNT = (int)ProfileField::Count;
+
+struct ProfileFieldInfo {
+    const wchar_t* key;
+    const wchar_t* label;
+    std::vector<const wchar_t*> options;
+};
+
+const ProfileFieldInfo PROFILE_FIELDS[PROFILE_FIELD_COUNT] = {
+    {L"CpuAccuracy", L"CPU Accuracy", {L"Auto", L"Accurate", L"Unsafe", L"Paranoid"}},
+    {L"MultiCore", L"Multicore CPU", {L"Disabled", L"Enabled"}},
+    {L"Resolution", L"Resolution Scale", {L"0.5x", L"0.75x", L"1x", L"1.5x", L"2x", L"3x"}},
+    {L"AsyncShaders", L"Asynchronous Shaders", {L"Disabled", L"Enabled"}},
+    {L"MemoryLayout", L"Memory Layout", {L"4GB", L"6GB", L"8GB"}},
+    {L"TargetFps", L"Dynamic Resolution", {L"Off", L"30 FPS", L"60 FPS"}},
+    {L"ResolutionMin", L"Minimum Resolution", {L"0.5x", L"0.75x", L"1x", L"1.5x", L"2x", L"3x"}},
+    {L"ResolutionMax", L"Maximum Resolution", {L"0.5x", L"0.75x", L"1x", L"1.5x", L"2x", L"3x"}},
+};
+
+struct TitleProfile {
+    int values[PROFILE_FIELD_COUNT] = {-1, -1, -1, -1, -1, -1, -1, -1};
+};
+
+// Profile screen state, UI thread only.
+TitleProfile g_EditingProfile;
+uint64_t g_EditingProfileTitleId = 0;
+std::wstring g_EditingProfileName;
+
+static std::filesystem::path GetTitleProfilePath(uint64_t title_id) {
+    return GetUserDirectory() / "config" / "custom" / fmt::format("{:016X}.ini", title_id);
+}
+
+static TitleProfile LoadTitleProfileFile(const std::filesystem::path& path) {
+    TitleProfile profile;
+    std::wifstream file(path);
+    if (!file.is_open()) return profile;
+
+    std::wstring line;
+    while (std::getline(file, line)) {
+        line = Trim(line);
+        if (line.empty() || line[0] == L'[') continue;
+        size_t eq = line.find(L'=');
+        if (eq == std::wstring::npos) continue;
+        std::wstring key = Trim(line.substr(0, eq));
+        int val = _wtoi(Trim(line.substr(eq + 1)).c_str());
+        for (int i = 0; i < PROFILE_FIELD_COUNT; ++i) {
+            if (key == PROFILE_FIELDS[i].key && val >= -1 && val < (int)PROFILE_FIELDS[i].options.size()) profile.values[i] = val;
+        }
+    }
+    return profile;
+}
+
+static TitleProfile LoadTitleProfile(uint64_t title_id) {
+    return title_id == 0 ? TitleProfile{} : LoadTitleProfileFile(GetTitleProfilePath(title_id));
+}
+
+static void SaveTitleProfile(uint64_t title_id, const TitleProfile& profile) {
+    auto path = GetTitleProfilePath(title_id);
+    std::error_code ec;
+    bool empty = std::all_of(std::begin(profile.values), std::end(profile.values), [](int v) { return v < 0; });
+    if (empty) { fs::remove(path, ec); return; }
+
+    fs::create_directories(path.parent_path(), ec);
+    std::wofstream file(path);
+    if (!file.is_open()) return;
+    file << L"[Profile]" << std::endl;
+    for (int i = 0; i < PROFILE_FIELD_COUNT; ++i) {
+        file << PROFILE_FIELDS[i].key << L"=" << profile.values[i] << std::endl;
+    }
+}
+
+static void ApplyTitleProfile(const TitleProfile& profile) {
+    auto apply = [&](ProfileField field, auto& setting, auto value) {
+        if (profile.values[(int)field] < 0) return;
+        setting.SetGlobal(false);
+        setting.SetValue(value);
+    };
+    const int* v = profile.values;
+    apply(ProfileField::CpuAccuracy, Settings::values.cpu_accuracy, (Settings::CpuAccuracy)v[(int)ProfileField::CpuAccuracy]);
+    apply(ProfileField::MultiCore, Settings::values.use_multi_core, v[(int)ProfileField::MultiCore] != 0);
+    apply(ProfileField::Resolution, Settings::values.resolution_setup, (Settings::ResolutionSetup)v[(int)ProfileField::Resolution]);
+    apply(ProfileField::AsyncShaders, Settings::values.use_asynchronous_shaders, v[(int)ProfileField::AsyncShaders] != 0);
+    apply(ProfileField::MemoryLayout, Settings::values.memory_layout_mode, (Settings::MemoryLayout)v[(int)ProfileField::MemoryLayout]);
+    Settings::UpdateRescalingInfo();
+}
+
+static void ClearTitleProfile() {
+    Settings::RestoreGlobalState(false);
+    Settings::UpdateRescalingInfo();
+}
+
+// Titles whose metadata isn't cached yet still get their profile: the ID is
+// read from the package itself.
+static uint64_t ReadTitleId(const std::filesystem::path& path) {
+    auto file = g_System->GetFilesystem()->OpenFile(WideToUtf8(path.wstring()), FileSys::OpenMode::Read);
+    if (!file) return 0;
+    std::unique_lock lock(g_LoaderMutex);
+    auto loader = Loader::GetLoader(*g_System, file);
+    u64 program_id = 0;
+    if (!loader || loader->ReadProgramId(program_id) != Loader::ResultStatus::Success) return 0;
+    return program_id;
+}
+
+static void OpenTitleProfile(HWND hwnd, const Game& game) {
+    if (game.title_id == 0) {
+        MessageBoxW(hwnd, L"The title ID of this game isn't known yet.\nWait for the library to finish reading it, or check your keys.", L"Profile", MB_OK);
+        return;
+    }
+    g_EditingProfileTitleId = game.title_id;
+    g_EditingProfileName = GetDisplayName(game);
+    g_EditingProfile = LoadTitleProfile(game.title_id);
+    g_AppState = AppState::Profile;
+    g_SelectedSettingIndex = 0;
+    g_IsEditingSetting = false;
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// --- Dynamic Resolution ---
+// Picks a title's resolution scale from how hard the GPU thread works to hold
+// the profile's target frame rate. The core only reads the scale at boot, so
+// the loop is closed across sessions: a running title is measured, and on
+// stop the chosen scale, stepped at most one option and kept within the
+// profile's bounds, is written back as the profile's Resolution for the next
+// boot. Stepping down needs DYNRES_DOWN_MS of continuous GPU-bound misses;
+// stepping up needs DYNRES_UP_MS of continuous headroom and no miss in the
+// session. Between the two thresholds nothing changes, so a title that sits
+// near its budget doesn't flip between scales from one boot to the next.
+// Intervals with shaders compiling are skipped.
+const int DYNRES_DOWN_MS = 5000;
+const int DYNRES_UP_MS = 60000;
+const float DYNRES_OVER_BUDGET = 1.10f; // frame time over the budget that counts as a miss
+const float DYNRES_GPU_BOUND = 85.0f;   // GPU thread load at which a miss is the GPU's doing
+const float DYNRES_GPU_IDLE = 50.0f;    // below this at target there's room for more pixels
+const float DYNRES_SMOOTHING = 0.2f;    // weight of the newest interval
+
+const int DYNRES_TARGET_FPS[] = {0, 30, 60}; // by TargetFps profile option
+
+struct DynResState {
+    bool enabled = false;
+    uint64_t titleId = 0;
+    int targetFps = 0;
+    int minIndex = 0, maxIndex = 0;
+    int bootIndex = 0; // resolution option this session runs at
+    float frametimeMs = 0, gpuLoad = 0; // smoothed
+    int overMs = 0, headroomMs = 0;     // how long the current condition has held
+    int step = 0;                       // -1 down, 0 hold, +1 up; a down is final
+};
+
+std::mutex g_DynResMutex;
+DynResState g_DynRes;
+
+// Called by BootThread after the title's profile is applied, except in
+// benchmark runs, which measure a fixed configuration. Clamps the scale this
+// boot uses into the profile's bounds.
+static void StartDynamicResolution(uint64_t titleId, const TitleProfile& profile) {
+    std::lock_guard lock(g_DynResMutex);
+    g_DynRes = DynResState{};
+    int target = profile.values[(int)ProfileField::TargetFps];
+    if (titleId == 0 || target <= 0) return;
+    int last = (int)PROFILE_FIELDS[(int)ProfileField::Resolution].options.size() - 1;
+    int lo = profile.values[(int)ProfileField::ResolutionMin], hi = profile.values[(int)ProfileField::ResolutionMax];
+    g_DynRes.minIndex = lo < 0 ? 0 : lo;
+    g_DynRes.maxIndex = std::max(g_DynRes.minIndex, hi < 0 ? last : hi);
+    int current = (int)Settings::values.resolution_setup.GetValue();
+    g_DynRes.bootIndex = std::clamp(current, g_DynRes.minIndex, g_DynRes.maxIndex);
+    if (g_DynRes.bootIndex != current) {
+        Settings::values.resolution_setup.SetGlobal(false);
+        Settings::values.resolution_setup.SetValue((Settings::ResolutionSetup)g_DynRes.bootIndex);
+        Settings::UpdateRescalingInfo();
+    }
+    g_DynRes.titleId = titleId;
+    g_DynRes.targetFps = DYNRES_TARGET_FPS[target];
+    g_DynRes.enabled = true;
+}
+
+// Fed one perf interval at a time from the sampler thread.
+static void UpdateDynamicResolution(float frametimeMs, float gpuLoad, bool compiling, int intervalMs) {
+    std::lock_guard lock(g_DynResMutex);
+    DynResState& d = g_DynRes;
+    if (!d.enabled || compiling || frametimeMs <= 0) return;
+    if (d.frametimeMs == 0) {
+        d.frametimeMs = frametimeMs;
+        d.gpuLoad = gpuLoad;
+    }
+    d.frametimeMs += (frametimeMs - d.frametimeMs) * DYNRES_SMOOTHING;
+    d.gpuLoad += (gpuLoad - d.gpuLoad) * DYNRES_SMOOTHING;
+
+    float budgetMs = 1000.0f / d.targetFps;
+    bool over = d.frametimeMs > budgetMs * DYNRES_OVER_BUDGET && d.gpuLoad >= DYNRES_GPU_BOUND;
+    bool headroom = d.frametimeMs <= budgetMs * DYNRES_OVER_BUDGET && d.gpuLoad < DYNRES_GPU_IDLE;
+    d.overMs = over ? d.overMs + intervalMs : 0;
+    d.headroomMs = headroom ? d.headroomMs + intervalMs : 0;
+    if (d.overMs >= DYNRES_DOWN_MS) d.step = -1;
+    else if (d.step == 0 && d.headroomMs >= DYNRES_UP_MS) d.step = 1;
+}
+
+static DynResState GetDynamicResolution() {
+    std::lock_guard lock(g_DynResMutex);
+    return g_DynRes;
+}
+
+static int GetDynResNextIndex(const DynResState& d) {
+    return std::clamp(d.bootIndex + d.step, d.minIndex, d.maxIndex);
+}
+
+// Writes the next boot's scale into the profile. Called when the title stops.
+static void CommitDynamicResolution() {
+    DynResState d;
+    {
+        std::lock_guard lock(g_DynResMutex);
+        d = g_DynRes;
+        g_DynRes.enabled = false;
+    }
+    if (!d.enabled) return;
+    int next = GetDynResNextIndex(d);
+    TitleProfile profile = LoadTitleProfile(d.titleId);
+    if (profile.values[(int)ProfileField::Resolution] == next) return;
+    profile.values[(int)ProfileField::Resolution] = next;
+    SaveTitleProfile(d.titleId, profile);
+}
+
+// --- Boot Pipeline ---
+// StartGame() hands the title to a boot thread so the UI keeps painting and
+// polling input. Each stage posts WM_APP_BOOT_STAGE with the time the previous
+// one took; a cancel request from the UI is honoured between stages.
+enum class BootStage { Validate, InitSystem, LoadRom, LoadShaders, StartGpu, Run, Count };
+const wchar_t* BOOT_STAGE_NAMES[] = {L"Validate", L"Initialize System", L"Load ROM", L"Load Shaders", L"Start GPU", L"Run"};
+const char* BOOT_STAGE_TRACE_NAMES[] = {"Boot: Validate", "Boot: InitSystem", "Boot: LoadRom", "Boot: LoadShaders", "Boot: StartGpu", "Boot: Run"};
+const ULONGLONG BOOT_PROGRESS_INTERVAL_MS = 50; // large shader caches report every pipeline
+
+enum class BootResult { Success, Failed, Cancelled };
+
+struct BootStatus {
+    std::wstring title;
+    std::filesystem::path path;
+    int stage = 0;              // stage currently running, Count once finished
+    ULONGLONG stageStart = 0;
+    ULONGLONG stageMs[(int)BootStage::Count] = {};
+    size_t progress = 0;        // items done/total within the current stage, if it reports any
+    size_t progressTotal = 0;
+    size_t shadersLoaded = 0;   // pipelines built from the disk cache
+};
+
+BootStatus g_Boot; // UI thread only
+std::atomic<bool> g_BootCancel = false;
+
+// Set from the command line before the window exists and read-only after.
+struct BenchmarkRun {
+    bool active = false;
+    std::filesystem::path title;
+    std::filesystem::path profile; // profile .ini used instead of the title's own
+    std::filesystem::path output;
+    int durationSec = 60;
+    int exitCode = 0;
+};
+
+BenchmarkRun g_Benchmark;
+
+static void BootThread(HWND hwnd, Game game) {
+    TRACE_THREAD_NAME("Boot");
+    TRACE_NAMED_SCOPE(stageSpan, nullptr);
+    ULONGLONG stageStart = GetTickCount64();
+    auto enterStage = [&](BootStage stage) {
+        TRACE_NEXT(stageSpan, stage < BootStage::Count ? BOOT_STAGE_TRACE_NAMES[(int)stage] : nullptr);
+        ULONGLONG now = GetTickCount64();
+        PostMessageW(hwnd, WM_APP_BOOT_STAGE, (WPARAM)stage, (LPARAM)(now - stageStart));
+        stageStart = now;
+        return !g_BootCancel;
+    };
+    auto finish = [&](BootResult result, BootError* error = nullptr) {
+        if (result != BootResult::Success) {
+            ClearTitleProfile();
+            DeactivateRomCache();
+        }
+        enterStage(BootStage::Count);
+        if (!PostMessageW(hwnd, WM_APP_BOOT_DONE, (WPARAM)result, reinterpret_cast<LPARAM>(error))) delete error;
+    };
+    // Past Load() the process exists and has to be torn down again on cancel.
+    auto cancelLoaded = [&] {
+        g_System->ShutdownMainProcess();
+        ReleaseMemory(MemoryCategory::GuestRam, g_MemoryCharged[(int)MemoryCategory::GuestRam]);
+        finish(BootResult::Cancelled);
+    };
+
+    enterStage(BootStage::Validate);
+    if (auto error = CheckBootPrerequisites()) {
+        finish(BootResult::Failed, error.release());
+        return;
+    }
+
+    try {
+        // Usually a no-op: the warm-up finished while the user was browsing.
+        if (!enterStage(BootStage::InitSystem)) { finish(BootResult::Cancelled); return; }
+        WarmSystem();
+
+        if (!enterStage(BootStage::LoadRom)) { finish(BootResult::Cancelled); return; }
+
+        // Overrides go in before Load(), which re-initializes for a changed core config.
+        uint64_t titleId = game.title_id ? game.title_id : ReadTitleId(game.path);
+        TitleProfile profile = g_Benchmark.profile.empty() ? LoadTitleProfile(titleId) : LoadTitleProfileFile(g_Benchmark.profile);
+        ApplyTitleProfile(profile);
+        if (!g_Benchmark.active) StartDynamicResolution(titleId, profile);
+
+        ConfigureGuestInput();
+
+        auto layout = Settings::values.memory_layout_mode.GetValue();
+        if (!SizeMemoryBudget(layout)) {
+            std::wstring msg = L"Not enough memory for the " + std::to_wstring(GetGuestMemoryBytes(layout) / GIB) +
+                L"GB memory layout.\nPick a smaller layout in Settings > System or in this title's profile.";
+            finish(BootResult::Failed, new BootError{L"Boot Error", msg, MB_ICONERROR});
+            return;
+        }
+
+        Service::AM::FrontendAppletParameters params{};
+        params.launch_type = Service::AM::LaunchType::FrontendInitiated;
+
+        std::unique_lock loaderLock(g_LoaderMutex);
+        Core::SystemResultStatus load_result = g_System->Load(*g_EmuWindow, game.path.string(), params);
+        loaderLock.unlock();
+
+        if (load_result != Core::SystemResultStatus::Success) {
+            std::string err = fmt::format("Boot Failed Error Code: {}", (int)load_result);
+            std::wstring werr(err.begin(), err.end());
+            finish(BootResult::Failed, new BootError{L"Boot Error", werr, MB_OK});
+            return;
+        }
+
+        ChargeMemory(MemoryCategory::GuestRam, (int64_t)GetGuestMemoryBytes(layout));
+
+        // Builds every pipeline in the title's disk cache up front; the rasterizer
+        // spreads the work over its own builder threads. As in the Qt frontend,
+        // this thread holds the GPU context for it and the GPU starts after.
+        if (!enterStage(BootStage::LoadShaders)) { cancelLoaded(); return; }
+        if (g_PrewarmShaders) {
+            std::stop_source stopLoading;
+            std::atomic<ULONGLONG> lastProgress = 0; // builder threads report too
+            g_System->GPU().ObtainContext();
+            g_System->Renderer().ReadRasterizer()->LoadDiskResources(g_System->GetApplicationProcessProgramID(), stopLoading.get_token(),
+                [&](VideoCore::LoadCallbackStage, size_t value, size_t total) {
+                    if (g_BootCancel) stopLoading.request_stop();
+                    ULONGLONG now = GetTickCount64();
+                    if (value < total && now - lastProgress < BOOT_PROGRESS_INTERVAL_MS) return;
+                    lastProgress = now;
+                    PostMessageW(hwnd, WM_APP_BOOT_PROGRESS, (WPARAM)value, (LPARAM)total);
+                });
+            g_System->GPU().ReleaseContext();
+        }
+
+        if (!enterStage(BootStage::StartGpu)) { cancelLoaded(); return; }
+        g_System->GPU().Start();
+
+        if (!enterStage(BootStage::Run)) { cancelLoaded(); return; }
+        g_System->GetCpuManager().OnGpuReady();
+        g_System->Run();
+        finish(BootResult::Success);
+    } catch (const std::exception& e) {
+        std::string err = fmt::format("Crash: {}", e.what());
+        std::wstring werr(err.begin(), err.end());
+        finish(BootResult::Failed, new BootError{L"Critical Error", werr, MB_OK | MB_ICONERROR});
+    }
+}
+
+static void StartGame(HWND hwnd, const Game& game) {
+    if (g_AppState == AppState::Booting) return;
+    TRACE_SCOPE("StartGame");
+    if (!g_Benchmark.active && IsSolidCompressedPackage(game.path)) {
+        std::wstring msg = GetDisplayName(game) + L" is a solid-compressed package. Reading it out of order decompresses it again from the start, "
+            L"so loading and playing can be very slow.\nRecompress it with block compression (nsz -B) to avoid this.\n\nBoot it anyway?";
+        if (MessageBoxW(hwnd, msg.c_str(), L"Slow Package", MB_YESNO | MB_ICONWARNING) != IDYES) return;
+    }
+    EnsureSystem();
+    if (!g_EmuWindow) g_EmuWindow = std::make_unique<XboxEmuWindow>(hwnd);
+
+    g_Boot = {};
+    g_Boot.title = GetDisplayName(game);
+    g_Boot.path = game.path;
+    g_Boot.stageStart = GetTickCount64();
+    g_BootCancel = false;
+    g_AppState = AppState::Booting;
+    ActivateRomCache();
+    // The video core creates its swapchain on this HWND during Load().
+    if (g_D2DCanvas) g_D2DCanvas->ReleaseSurface();
+    SetTimer(hwnd, BOOT_REFRESH_TIMER, 250, NULL);
+    InvalidateRect(hwnd, NULL, FALSE);
+    std::thread(BootThread, hwnd, game).detach();
+}
+
+static void OnBootStage(HWND hwnd, int stage, ULONGLONG previousMs) {
+    if (stage > 0 && stage <= (int)BootStage::Count) g_Boot.stageMs[stage - 1] = previousMs;
+    g_Boot.stage = stage;
+    g_Boot.stageStart = GetTickCount64();
+    g_Boot.progress = g_Boot.progressTotal = 0;
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+static void OnBootDone(HWND hwnd, BootResult result, std::unique_ptr<BootError> error) {
+    KillTimer(hwnd, BOOT_REFRESH_TIMER);
+    g_AppState = result == BootResult::Success ? AppState::Running : AppState::GameList;
+    if (result == BootResult::Success) {
+        MarkGamePlayed(g_Boot.path);
+        StartInputThread();
+        StartPerfSampler();
+        StartThreadPlacement(hwnd);
+    }
+    InvalidateRect(hwnd, NULL, FALSE);
+    if (g_Benchmark.active) {
+        if (result == BootResult::Success) SetTimer(hwnd, BENCHMARK_TIMER, g_Benchmark.durationSec * 1000, NULL);
+        else FinishBenchmark(hwnd, error ? error->message.c_str() : L"Boot cancelled");
+        return;
+    }
+    if (error) MessageBoxW(hwnd, error->message.c_str(), error->title.c_str(), error->flags);
+}
+
+// --- Shader Caches ---
+// Per-title disk pipeline caches as the video core writes them, one folder per
+// title ID under user/shader. Listed in the Graphics tab with their size; a
+// cache is stale when no title in the library has its ID. While a library
+// title's ID is still unknown no cache counts as stale, as it may be that
+// title's.
+// Guest CPU code has no counterpart: the core's recompiler keeps its
+// translations in memory only and has no interface to save or seed them.
+struct ShaderCacheEntry {
+    uint64_t title_id = 0;
+    std::filesystem::path path;
+    uint64_t bytes = 0;
+    std::wstring label;
+    bool stale = false;
+};
+
+std::vector<ShaderCacheEntry> g_ShaderCaches; // rebuilt on entering the Graphics tab
+const int GRAPHICS_FIXED_ROWS = 3;             // pre-warm toggle, UI renderer, purge stale
+
+static std::wstring FormatBytes(uint64_t bytes) {
+    const wchar_t* units[] = {L"B", L"KB", L"MB", L"GB"};
+    double v = (double)bytes;
+    int u = 0;
+    while (v >= 1024.0 && u < 3) { v /= 1024.0; ++u; }
+    wchar_t buf[32];
+    swprintf_s(buf, u == 0 ? L"%.0f %s" : L"%.1f %s", v, units[u]);
+    return buf;
+}
+
+static void RefreshShaderCaches() {
+    g_ShaderCaches.clear();
+    bool unknownIds = std::any_of(g_Games.begin(), g_Games.end(), [](const Game& game) { return game.title_id == 0; });
+    std::error_code ec;
+    for (fs::directory_iterator it(GetUserDirectory() / "shader", ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        std::error_code entryEc;
+        if (!it->is_directory(entryEc)) continue;
+        std::wstring name = it->path().filename().wstring();
+        if (name.size() != 16) continue;
+        wchar_t* endp = nullptr;
+        uint64_t tid = std::wcstoull(name.c_str(), &endp, 16);
+        if (tid == 0 || *endp != L'\0') continue;
+
+        ShaderCacheEntry e;
+        e.title_id = tid;
+        e.path = it->path();
+        for (fs::recursive_directory_iterator f(e.path, entryEc); !entryEc && f != fs::recursive_directory_iterator(); f.increment(entryEc)) {
+            std::error_code sizeEc;
+            if (f->is_regular_file(sizeEc)) e.bytes += f->file_size(sizeEc);
+        }
+        e.label = name;
+        e.stale = true;
+        for (const auto& game : g_Games) {
+            if (game.title_id == tid) { e.label = GetDisplayName(game); e.stale = false; break; }
+        }
+        // Until the scan is over a missing title may just not be listed yet.
+        if (g_ScanWorkersActive > 0 || unknownIds) e.stale = false;
+        g_ShaderCaches.push_back(std::move(e));
+    }
+    std::sort(g_ShaderCaches.begin(), g_ShaderCaches.end(), [](const auto& a, const auto& b) { return a.bytes > b.bytes; });
+}
+
+static void PurgeShaderCache(HWND hwnd, size_t index) {
+    if (index >= g_ShaderCaches.size()) return;
+    const auto& e = g_ShaderCaches[index];
+    std::wstring msg = L"Delete the shader cache for " + e.label + L" (" + FormatBytes(e.bytes) + L")?";
+    if (MessageBoxW(hwnd, msg.c_str(), L"Shader Cache", MB_YESNO | MB_ICONQUESTION) != IDYES) return;
+    std::error_code ec;
+    fs::remove_all(e.path, ec);
+    RefreshShaderCaches();
+}
+
+static void PurgeStaleShaderCaches(HWND hwnd) {
+    uint64_t bytes = 0;
+    int count = 0;
+    for (const auto& e : g_ShaderCaches) if (e.stale) { bytes += e.bytes; ++count; }
+    if (count == 0) { MessageBoxW(hwnd, L"No stale shader caches.", L"Shader Cache", MB_OK); return; }
+    std::wstring msg = L"Delete " + std::to_wstring(count) + L" caches of titles not in the library (" + FormatBytes(bytes) + L")?";
+    if (MessageBoxW(hwnd, msg.c_str(), L"Shader Cache", MB_YESNO | MB_ICONQUESTION) != IDYES) return;
+    for (const auto& e : g_ShaderCaches) {
+        std::error_code ec;
+        if (e.stale) fs::remove_all(e.path, ec);
+    }
+    RefreshShaderCaches();
+}
+
+// --- Audio Output ---
+// The Audio tab: output engine, output device and volume, saved through the
+// [Audio] rows of SETTING_DEFS. The engine and device are read when a title
+// boots; volume is picked up by the running mixer. Devices are listed by the
+// selected engine when the tab is entered or the engine changes; "auto" is
+// the engine's default device and comes first.
+const wchar_t* const AUDIO_ITEM_LABELS[] = {L"Output Engine", L"Output Device", L"Volume"};
+const int AUDIO_ITEM_COUNT = (int)std::size(AUDIO_ITEM_LABELS);
+const wchar_t* const AUDIO_ENGINE_NAMES[] = {L"Auto", L"Cubeb", L"SDL2", L"Null"};
+const int AUDIO_VOLUME_STEP = 10;
+
+std::vector<std::string> g_AudioDevices; // UI thread only
+
+static void RefreshAudioDevices() {
+    g_AudioDevices = AudioCore::Sink::GetDeviceListForSink(Settings::values.sink_id.GetValue(), false);
+    g_AudioDevices.insert(g_AudioDevices.begin(), "auto");
+}
+
+static void FormatAudioItem(int i, wchar_t* buf, size_t len) {
+    switch (i) {
+    case 0: wcscpy_s(buf, len, AUDIO_ENGINE_NAMES[GetAudioEngineIndex()]); break;
+    case 1: {
+        const std::string& device = Settings::values.audio_output_device_id.GetValue();
+        wcsncpy_s(buf, len, device == "auto" ? L"Default" : Utf8ToWide(device).c_str(), _TRUNCATE);
+        break;
+    }
+    case 2: swprintf_s(buf, len, L"%d%%", (int)Settings::values.volume.GetValue(true)); break;
+    default: buf[0] = L'\0'; break;
+    }
+}
+
+static void StepAudioItem(int i, int dir) {
+    switch (i) {
+    case 0: {
+        int engine = (GetAudioEngineIndex() + dir + AUDIO_ENGINE_COUNT) % AUDIO_ENGINE_COUNT;
+        Settings::values.sink_id.SetValue(AUDIO_ENGINES[engine]);
+        // Device names belong to an engine; keep the device only if the new one has it too.
+        RefreshAudioDevices();
+        const std::string& device = Settings::values.audio_output_device_id.GetValue();
+        if (std::find(g_AudioDevices.begin(), g_AudioDevices.end(), device) == g_AudioDevices.end()) {
+            Settings::values.audio_output_device_id.SetValue("auto");
+        }
+        break;
+    }
+    case 1: {
+        if (g_AudioDevices.empty()) RefreshAudioDevices();
+        auto it = std::find(g_AudioDevices.begin(), g_AudioDevices.end(), Settings::values.audio_output_device_id.GetValue());
+        int n = (int)g_AudioDevices.size();
+        int index = it == g_AudioDevices.end() ? 0 : (int)(it - g_AudioDevices.begin());
+        Settings::values.audio_output_device_id.SetValue(g_AudioDevices[(index + dir + n) % n]);
+        break;
+    }
+    case 2: {
+        int volume = std::clamp((int)Settings::values.volume.GetValue(true) + dir * AUDIO_VOLUME_STEP, 0, 200);
+        Settings::values.volume.SetValue((u8)volume);
+        break;
+    }
+    }
+}
+
+// --- Layout & Invalidation ---
+// Row geometry is shared between RenderUI and the invalidation helpers so a
+// selection move repaints just the rows it touched. The game list scrolls
+// only when the selection reaches an edge, so most moves stay two rows.
+const int GAME_LIST_TOP = 80, GAME_ROW_PITCH = 40, GAME_ROW_HEIGHT = 36;
+const int SETTINGS_CONTENT_TOP = 110, PROFILE_CONTENT_TOP = 120, SETTINGS_ROW_PITCH = 50, SETTINGS_ROW_HEIGHT = 40;
+
+int g_GameListTop = 0;
+
+static int GetGameListVisibleRows(int height) {
+    return std::max(1, (height - 100) / GAME_ROW_PITCH);
+}
+
+// Returns true when the first visible row changed.
+static bool ScrollGameListTo(int selected, int visibleRows) {
+    int top = g_GameListTop;
+    if (selected < top) top = selected;
+    else if (selected >= top + visibleRows) top = selected - visibleRows + 1;
+    top = std::clamp(top, 0, std::max(0, GetGameViewCount() - visibleRows));
+    if (top == g_GameListTop) return false;
+    g_GameListTop = top;
+    return true;
+}
+
+static void InvalidateRow(HWND hwnd, int row) {
+    RECT rc; GetClientRect(hwnd, &rc);
+    RECT r;
+    if (g_AppState == AppState::GameList) {
+        int y = GAME_LIST_TOP + (row - g_GameListTop) * GAME_ROW_PITCH;
+        r = {100, y, rc.right - 100, y + GAME_ROW_HEIGHT};
+    } else if (g_AppState == AppState::Settings && g_CurrentTab == SettingsTab::Graphics) {
+        // Windowed and centred on the selection; repaint the whole list.
+        r = {40, SETTINGS_CONTENT_TOP, rc.right - 40, rc.bottom - 40};
+    } else {
+        int y = (g_AppState == AppState::Profile ? PROFILE_CONTENT_TOP : SETTINGS_CONTENT_TOP) + row * SETTINGS_ROW_PITCH;
+        r = {40, y, rc.right - 40, y + SETTINGS_ROW_HEIGHT};
+    }
+    InflateRect(&r, 1, 1);
+    InvalidateRect(hwnd, &r, FALSE);
+}
+
+// Moves a list selection and repaints the old and new rows, or the whole
+// list when the game list had to scroll.
+static void MoveSelection(HWND hwnd, int& index, int newIndex) {
+    if (newIndex == index) return;
+    int old = index;
+    index = newIndex;
+    if (g_AppState == AppState::GameList) {
+        RECT rc; GetClientRect(hwnd, &rc);
+        if (ScrollGameListTo(index, GetGameListVisibleRows(rc.bottom))) {
+            RECT list = {0, GAME_LIST_TOP - 1, rc.right, rc.bottom - 40};
+            InvalidateRect(hwnd, &list, FALSE);
+            return;
+        }
+    }
+    InvalidateRow(hwnd, old);
+    InvalidateRow(hwnd, index);
+}
+
+const wchar_t* const SYSTEM_ITEM_LABELS[] = {
+    L"Language", L"Region", L"Time Zone", L"Device Name", L"Custom RTC",
+    L"RNG Seed", L"Multicore CPU", L"Memory Layout", L"Menu Input Rate", L"Thread Placement",
+};
+const int SYSTEM_ITEM_COUNT = sizeof(SYSTEM_ITEM_LABELS) / sizeof(SYSTEM_ITEM_LABELS[0]);
+const wchar_t* const THREAD_PLACEMENT_NAMES[] = {L"Off", L"Soft (ideal cores)", L"Pinned"};
+
+static const wchar_t* GetLanguageName(int index) {
+    switch (index) {
+    case 0: return L"Japanese"; case 1: return L"American English"; case 2: return L"French";
+    case 3: return L"German"; case 4: return L"Italian"; case 5: return L"Spanish";
+    case 6: return L"Chinese"; case 7: return L"Korean"; case 8: return L"Dutch";
+    case 9: return L"Portuguese"; case 10: return L"Russian"; case 11: return L"Taiwanese";
+    case 12: return L"British English"; case 13: return L"Canadian French"; case 14: return L"Latin American Spanish";
+    case 15: return L"Simplified Chinese"; case 16: return L"Traditional Chinese"; case 17: return L"Brazilian Portuguese";
+    default: return L"Unknown";
+    }
+}
+
+// Writes the display value of System tab row `i` into a caller-owned buffer.
+static void FormatSystemItem(int i, wchar_t* buf, size_t len) {
+    switch (i) {
+    case 0: wcscpy_s(buf, len, GetLanguageName((int)Settings::values.language_index.GetValue())); break;
+    case 1: wcscpy_s(buf, len, Settings::values.region_index.GetValue() == Settings::Region::Usa ? L"USA" : L"Other"); break;
+    case 2: wcscpy_s(buf, len, L"Auto"); break;
+    case 3: _snwprintf_s(buf, len, _TRUNCATE, L"%hs", Settings::values.device_name.GetValue().c_str()); break;
+    case 4: wcscpy_s(buf, len, Settings::values.custom_rtc_enabled.GetValue() ? L"Enabled" : L"Disabled"); break;
+    case 5: wcscpy_s(buf, len, L"00000000"); break;
+    case 6: wcscpy_s(buf, len, Settings::values.use_multi_core.GetValue() ? L"Enabled" : L"Disabled"); break;
+    case 7: wcscpy_s(buf, len, Settings::values.memory_layout_mode.GetValue() == Settings::MemoryLayout::Memory_4Gb ? L"4GB" : L"6GB"); break;
+    case 8: swprintf_s(buf, len, L"%d Hz", g_MenuPollRate); break;
+    case 9: wcscpy_s(buf, len, THREAD_PLACEMENT_NAMES[(int)g_ThreadPlacement]); break;
+    default: buf[0] = 0; break;
+    }
+}
+
+
+static void DrawSettingValue(UiCanvas& canvas, const wchar_t* val, bool editing, const RectF& valRect) {
+    canvas.Fill(valRect, UiColor::ItemBg);
+    if (editing) {
+        std::wstring buf = L"< " + std::wstring(val) + L" >";
+        canvas.Text(buf.c_str(), valRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+    } else {
+        canvas.Text(val, valRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+    }
+}
+
+// Draws every screen from its owner's state, so it stays below those
+// sections: the boot pipeline (g_Boot, g_BootCancel, BOOT_STAGE_NAMES), the
+// shader caches (g_ShaderCaches, GRAPHICS_FIXED_ROWS, FormatBytes) and the
+// title profiles (PROFILE_FIELDS, g_EditingProfile*).
+static void RenderUI(UiCanvas& canvas, int width, int height) {
+    if (g_AppState == AppState::Running) return;
+
+    canvas.Fill(RectF(0, 0, (REAL)width, (REAL)height), UiColor::Bg);
+
+    RectF titleRect(0, 10, (REAL)width, 40);
+    canvas.Text(L"CITRON", titleRect, UiFont::Title, UiAlign::Center, UiColor::Accent);
+
+    if (g_IsInstalling) {
+        RectF r(0, (REAL)height / 2 - 20, (REAL)width, 80);
+        canvas.Text(GetInstallStatusText().c_str(), r, UiFont::Status, UiAlign::Center, UiColor::Text);
+        return;
+    }
+
+    if (g_AppState == AppState::GameList) {
+        RebuildGameOrder();
+        wchar_t viewLabel[64];
+        if (g_LetterFilter >= 0) swprintf_s(viewLabel, L"Sort: %s  |  %c", GAME_SORT_NAMES[(int)g_GameSort], g_LetterFilter == 0 ? L'#' : (wchar_t)(L'A' + g_LetterFilter - 1));
+        else swprintf_s(viewLabel, L"Sort: %s", GAME_SORT_NAMES[(int)g_GameSort]);
+        canvas.Text(viewLabel, RectF((REAL)width - 420, 20, 320, 30), UiFont::Hint, UiAlign::RightMid, UiColor::Dim);
+
+        if (g_Games.empty()) {
+            RectF msgRect(0, (REAL)height / 2, (REAL)width, 40);
+            if (g_ScanWorkersActive > 0)
+                canvas.Text(L"Scanning for games...", msgRect, UiFont::Label, UiAlign::Center, UiColor::Text);
+            else
+                canvas.Text(L"No games found.\n1. Settings > Add Game Directory\n2. Settings > Install Prod Keys", msgRect, UiFont::Label, UiAlign::Center, UiColor::Text);
+        } else {
+            int visibleItems = GetGameListVisibleRows(height);
+            ScrollGameListTo(g_SelectedGameIndex, visibleItems);
+            int endIdx = std::min(GetGameViewCount(), g_GameListTop + visibleItems);
+            float y = GAME_LIST_TOP;
+            for (int i = g_GameListTop; i < endIdx; ++i, y += GAME_ROW_PITCH) {
+                RectF r(100.0f, y, (REAL)(width - 200), (REAL)GAME_ROW_HEIGHT);
+                if (!canvas.IsVisible(r)) continue;
+                const Game& game = GetViewGame(i);
+                const wchar_t* label = GetDisplayName(game).c_str();
+                bool sel = i == g_SelectedGameIndex;
+                canvas.Fill(r, sel ? UiColor::Selected : UiColor::ItemBg);
+                canvas.Text(label, r, UiFont::Item, UiAlign::Center, sel ? UiColor::SelText : UiColor::Text);
+                if (const uint8_t* px = GetIconPixels(game.path)) canvas.Icon(px, r.X + 2, r.Y + 2, 32.0f);
+            }
+        }
+    } else if (g_AppState == AppState::Profile) {
+        wchar_t head[320];
+        _snwprintf_s(head, _TRUNCATE, L"%s  [%016llX]", g_EditingProfileName.c_str(), (unsigned long long)g_EditingProfileTitleId);
+        RectF headRect(0, 60, (REAL)width, 40);
+        canvas.Text(head, headRect, UiFont::Head, UiAlign::Center, UiColor::Text);
+
+        float contentY = PROFILE_CONTENT_TOP;
+        for (int i = 0; i < PROFILE_FIELD_COUNT; ++i, contentY += SETTINGS_ROW_PITCH) {
+            RectF rowRect(40, contentY, (REAL)width - 80, (REAL)SETTINGS_ROW_HEIGHT);
+            if (!canvas.IsVisible(rowRect)) continue;
+            RectF labelRect(rowRect.X + 10, rowRect.Y + 10, 300, 20);
+            RectF valRect(rowRect.X + 350, rowRect.Y + 10, 300, 20);
+            bool sel = i == g_SelectedSettingIndex;
+            if (sel) canvas.Fill(rowRect, g_IsEditingSetting ? UiColor::Editing : UiColor::Highlight);
+            int v = g_EditingProfile.values[i];
+            canvas.Text(PROFILE_FIELDS[i].label, labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+            DrawSettingValue(canvas, v < 0 ? L"Global" : PROFILE_FIELDS[i].options[v], sel && g_IsEditingSetting, valRect);
+        }
+    } else if (g_AppState == AppState::Stopping) {
+        wchar_t head[300];
+        _snwprintf_s(head, _TRUNCATE, L"Stopping %s", g_Boot.title.c_str());
+        RectF headRect(0, 80, (REAL)width, 40);
+        canvas.Text(head, headRect, UiFont::Head, UiAlign::Center, UiColor::Text);
+    } else if (g_AppState == AppState::Booting) {
+        wchar_t head[300];
+        _snwprintf_s(head, _TRUNCATE, L"%s%s", g_BootCancel ? L"Cancelling " : L"Booting ", g_Boot.title.c_str());
+        RectF headRect(0, 80, (REAL)width, 40);
+        canvas.Text(head, headRect, UiFont::Head, UiAlign::Center, UiColor::Text);
+
+        float y = 150;
+        const int stageCount = (int)BootStage::Count;
+        for (int i = 0; i < stageCount; ++i) {
+            RectF rowRect((REAL)width / 2 - 300, y, 600, 36);
+            RectF labelRect(rowRect.X + 15, rowRect.Y, 380, rowRect.Height);
+            RectF timeRect(rowRect.X + 400, rowRect.Y, 185, rowRect.Height);
+            bool done = i < g_Boot.stage, current = i == g_Boot.stage;
+            canvas.Fill(rowRect, current ? UiColor::Accent : UiColor::ItemBg);
+            canvas.Text(BOOT_STAGE_NAMES[i], labelRect, UiFont::Label, UiAlign::LeftMid, done || current ? UiColor::Text : UiColor::Dim);
+            if (done || current) {
+                ULONGLONG ms = done ? g_Boot.stageMs[i] : GetTickCount64() - g_Boot.stageStart;
+                wchar_t t[64];
+                if (current && g_Boot.progressTotal > 0)
+                    swprintf_s(t, L"%zu / %zu   %llu ms", g_Boot.progress, g_Boot.progressTotal, ms);
+                else
+                    swprintf_s(t, L"%llu ms", ms);
+                canvas.Text(t, timeRect, UiFont::Label, UiAlign::RightMid, UiColor::Text);
+            }
+            y += 44;
+        }
+
+        RectF barRect((REAL)width / 2 - 300, y + 10, 600, 8);
+        canvas.Fill(barRect, UiColor::ItemBg);
+        barRect.Width *= (REAL)std::min(g_Boot.stage, stageCount) / stageCount;
+        canvas.Fill(barRect, UiColor::Accent);
+    } else if (g_AppState == AppState::Settings) {
+        const wchar_t* tabs[] = {L"General", L"System", L"Graphics", L"Audio", L"Network"};
+        float tabW = (float)(width - 40) / 5;
+        for (int i = 0; i < 5; ++i) {
+            RectF r(20 + i * tabW, 60, tabW - 5, 30);
+            canvas.Fill(r, (int)g_CurrentTab == i ? UiColor::Accent : UiColor::TabInactive);
+            canvas.Text(tabs[i], r, UiFont::Tab, UiAlign::Center, UiColor::Text);
+        }
+        float contentY = SETTINGS_CONTENT_TOP;
+
+        if (g_CurrentTab == SettingsTab::System) {
+            wchar_t val[128];
+            for (int i = 0; i < SYSTEM_ITEM_COUNT; ++i, contentY += SETTINGS_ROW_PITCH) {
+                RectF rowRect(40, contentY, (REAL)width - 80, (REAL)SETTINGS_ROW_HEIGHT);
+                if (!canvas.IsVisible(rowRect)) continue;
+                RectF labelRect(rowRect.X + 10, rowRect.Y + 10, 200, 20);
+                RectF valRect(rowRect.X + 250, rowRect.Y + 10, 300, 20);
+                bool sel = i == g_SelectedSettingIndex;
+                if (sel) canvas.Fill(rowRect, g_IsEditingSetting ? UiColor::Editing : UiColor::Highlight);
+                FormatSystemItem(i, val, std::size(val));
+                canvas.Text(SYSTEM_ITEM_LABELS[i], labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+                DrawSettingValue(canvas, val, sel && g_IsEditingSetting, valRect);
+            }
+        } else if (g_CurrentTab == SettingsTab::Audio) {
+            wchar_t val[256];
+            for (int i = 0; i < AUDIO_ITEM_COUNT; ++i, contentY += SETTINGS_ROW_PITCH) {
+                RectF rowRect(40, contentY, (REAL)width - 80, (REAL)SETTINGS_ROW_HEIGHT);
+                if (!canvas.IsVisible(rowRect)) continue;
+                RectF labelRect(rowRect.X + 10, rowRect.Y + 10, 200, 20);
+                RectF valRect(rowRect.X + 250, rowRect.Y + 10, 600, 20);
+                bool sel = i == g_SelectedSettingIndex;
+                if (sel) canvas.Fill(rowRect, g_IsEditingSetting ? UiColor::Editing : UiColor::Highlight);
+                FormatAudioItem(i, val, std::size(val));
+                canvas.Text(AUDIO_ITEM_LABELS[i], labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+                DrawSettingValue(canvas, val, sel && g_IsEditingSetting, valRect);
+            }
+        } else if (g_CurrentTab == SettingsTab::Graphics) {
+            int rows = GRAPHICS_FIXED_ROWS + (int)g_ShaderCaches.size();
+            int visibleRows = std::max(1, (int)((height - contentY - 40) / SETTINGS_ROW_PITCH));
+            int first = std::clamp(g_SelectedSettingIndex - visibleRows / 2, 0, std::max(0, rows - visibleRows));
+            for (int i = first; i < std::min(rows, first + visibleRows); ++i, contentY += SETTINGS_ROW_PITCH) {
+                RectF rowRect(40, contentY, (REAL)width - 80, (REAL)SETTINGS_ROW_HEIGHT);
+                if (!canvas.IsVisible(rowRect)) continue;
+                RectF labelRect(rowRect.X + 10, rowRect.Y + 10, 600, 20);
+                RectF valRect(rowRect.X + 650, rowRect.Y + 10, 300, 20);
+                if (i == g_SelectedSettingIndex) canvas.Fill(rowRect, g_IsEditingSetting ? UiColor::Editing : UiColor::Highlight);
+                if (i == 0) {
+                    canvas.Text(L"Pre-warm Shader Cache", labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+                    DrawSettingValue(canvas, g_PrewarmShaders ? L"Enabled" : L"Disabled", false, valRect);
+                } else if (i == 1) {
+                    canvas.Text(L"UI Renderer", labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+                    DrawSettingValue(canvas, g_UiRenderer == UiRendererKind::Direct2D ? L"Direct2D" : L"GDI+", false, valRect);
+                } else if (i == 2) {
+                    canvas.Text(L"Purge Stale Caches", labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+                } else {
+                    const auto& e = g_ShaderCaches[i - GRAPHICS_FIXED_ROWS];
+                    wchar_t label[160];
+                    _snwprintf_s(label, _TRUNCATE, L"%s%s", e.label.c_str(), e.stale ? L"  (not in library)" : L"");
+                    canvas.Text(label, labelRect, UiFont::Label, UiAlign::Left, UiColor::Text);
+                    DrawSettingValue(canvas, FormatBytes(e.bytes).c_str(), false, valRect);
+                }
+            }
+        } else if (g_CurrentTab == SettingsTab::General) {
+            const wchar_t* actions[] = {L"Install Prod Keys", L"Install Firmware", L"Add Game Directory", L"Install Update (NSP)", L"Install Update (XCI)"};
+            for (int i = 0; i < 5; ++i, contentY += SETTINGS_ROW_PITCH) {
+                RectF rowRect(40, contentY, (REAL)width - 80, (REAL)SETTINGS_ROW_HEIGHT);
+                if (!canvas.IsVisible(rowRect)) continue;
+                canvas.Fill(rowRect, i == g_SelectedSettingIndex ? UiColor::Highlight : UiColor::TabInactive);
+                canvas.Text(actions[i], rowRect, UiFont::Label, UiAlign::Center, UiColor::Text);
+            }
+        }
+    }
+    RectF fR(20, (REAL)height - 30, (REAL)width, 20);
+    const wchar_t* hint = g_GameSort == GameSort::Name
+        ? L"A: Play | Y: Profile | X: Sort | LT/RT: Page | LB/RB: Letter | Back: Filter Letter | Start: Settings"
+        : L"A: Play | Y: Profile | X: Sort | LT/RT: Page | Start: Settings";
+    if (g_AppState == AppState::Settings) hint = L"LB/RB: Tab | A: Select | B: Back";
+    else if (g_AppState == AppState::Booting) hint = L"B: Cancel";
+    else if (g_AppState == AppState::Stopping) hint = L"";
+    else if (g_AppState == AppState::Profile) hint = L"A: Edit | B: Save & Back";
+    canvas.Text(hint, fR, UiFont::Hint, UiAlign::Left, UiColor::Dim);
+}
+
+// --- Controller Manager ---
+// XInputGetState on an empty slot is the slow path, so only slots known to be
+// connected are polled every tick; empty ones are probed for hotplug once a
+// second. A pad whose packet number hasn't moved has nothing new to process.
+const ULONGLONG HOTPLUG_INTERVAL_MS = 1000;
+
+struct ControllerSlot {
+    bool connected = false;
+    DWORD packet = 0;
+    XINPUT_GAMEPAD pad = {};
+};
+
+ControllerSlot g_Controllers[MAX_CONTROLLERS]; // UI thread; the in-game input thread keeps its own
+ULONGLONG g_NextHotplugCheck = 0;
+
+// Returns true when any pad connected, disconnected or reported a new packet.
+static bool PollControllers(ControllerSlot* slots, ULONGLONG& nextHotplugCheck, ULONGLONG now) {
+    bool probeEmpty = now >= nextHotplugCheck;
+    if (probeEmpty) nextHotplugCheck = now + HOTPLUG_INTERVAL_MS;
+
+    bool changed = false;
+    for (DWORD i = 0; i < MAX_CONTROLLERS; ++i) {
+        ControllerSlot& slot = slots[i];
+        if (!slot.connected && !probeEmpty) continue;
+        XINPUT_STATE state;
+        if (XInputGetState(i, &state) == ERROR_SUCCESS) {
+            if (!slot.connected || state.dwPacketNumber != slot.packet) {
+                slot.pad = state.Gamepad;
+                slot.packet = state.dwPacketNumber;
+                changed = true;
+            }
+            slot.connected = true;
+        } else if (slot.connected) {
+            slot = {};
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// --- In-Game Input ---
+// While a title runs, a high-priority thread samples the connected pads at
+// INPUT_THREAD_RATE_HZ and writes every change straight into the core's
+// virtual gamepad driver, which the emulated controllers are mapped to.
+const int INPUT_THREAD_RATE_HZ = 1000;
+using VirtualButton = InputCommon::VirtualGamepad::VirtualButton;
+using VirtualStick = InputCommon::VirtualGamepad::VirtualStick;
+
+const std::pair<WORD, VirtualButton> XINPUT_BUTTON_MAP[] = {
+    // Positional, not by label: Xbox A sits where the Switch has B.
+    {XINPUT_GAMEPAD_A, VirtualButton::ButtonB},
+    {XINPUT_GAMEPAD_B, VirtualButton::ButtonA},
+    {XINPUT_GAMEPAD_X, VirtualButton::ButtonY},
+    {XINPUT_GAMEPAD_Y, VirtualButton::ButtonX},
+    {XINPUT_GAMEPAD_LEFT_SHOULDER, VirtualButton::TriggerL},
+    {XINPUT_GAMEPAD_RIGHT_SHOULDER, VirtualButton::TriggerR},
+    {XINPUT_GAMEPAD_LEFT_THUMB, VirtualButton::StickL},
+    {XINPUT_GAMEPAD_RIGHT_THUMB, VirtualButton::StickR},
+    {XINPUT_GAMEPAD_START, VirtualButton::ButtonPlus},
+    {XINPUT_GAMEPAD_BACK, VirtualButton::ButtonMinus},
+    {XINPUT_GAMEPAD_DPAD_UP, VirtualButton::ButtonUp},
+    {XINPUT_GAMEPAD_DPAD_DOWN, VirtualButton::ButtonDown},
+    {XINPUT_GAMEPAD_DPAD_LEFT, VirtualButton::ButtonLeft},
+    {XINPUT_GAMEPAD_DPAD_RIGHT, VirtualButton::ButtonRight},
+};
+
+std::thread g_InputThread;
+HANDLE g_InputStopEvent = NULL;
+
+// Maps player N to virtual gamepad port N; called before Load() so the HID
+// service comes up with the mapping in place.
+static void ConfigureGuestInput() {
+    if (!g_InputSubsystem) return;
+    auto& players = Settings::values.players.GetValue();
+    for (size_t p = 0; p < MAX_CONTROLLERS; ++p) {
+        auto& player = players[p];
+        XINPUT_STATE probe;
+        player.connected = p == 0 || XInputGetState((DWORD)p, &probe) == ERROR_SUCCESS;
+        player.controller_type = Settings::ControllerType::ProController;
+        for (size_t b = 0; b < Settings::NativeButton::NumButtons && b <= (size_t)VirtualButton::ButtonCapture; ++b) {
+            player.buttons[b] = fmt::format("engine:virtual_gamepad,port:{},button:{}", p, b);
+        }
+        player.analogs[Settings::NativeAnalog::LStick] = fmt::format("engine:virtual_gamepad,port:{},axis_x:0,axis_y:1,deadzone:0.0,range:1.0", p);
+        player.analogs[Settings::NativeAnalog::RStick] = fmt::format("engine:virtual_gamepad,port:{},axis_x:2,axis_y:3,deadzone:0.0,range:1.0", p);
+    }
+    g_System->HIDCore().ReloadInputDevices();
+}
+
+static void PushPadToGuest(size_t port, const XINPUT_GAMEPAD& pad, const XINPUT_GAMEPAD& prev) {
+    auto* gamepad = g_InputSubsystem->GetVirtualGamepad();
+    for (const auto& [mask, button] : XINPUT_BUTTON_MAP) {
+        bool now = (pad.wButtons & mask) != 0;
+        if (now != ((prev.wButtons & mask) != 0)) gamepad->SetButtonState(port, (int)button, now);
+    }
+    bool zl = pad.bLeftTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD, zr = pad.bRightTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD;
+    if (zl != (prev.bLeftTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD)) gamepad->SetButtonState(port, (int)VirtualButton::TriggerZL, zl);
+    if (zr != (prev.bRightTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD)) gamepad->SetButtonState(port, (int)VirtualButton::TriggerZR, zr);
+    if (pad.sThumbLX != prev.sThumbLX || pad.sThumbLY != prev.sThumbLY)
+        gamepad->SetStickPosition(port, VirtualStick::Left, pad.sThumbLX / 32767.0f, pad.sThumbLY / 32767.0f);
+    if (pad.sThumbRX != prev.sThumbRX || pad.sThumbRY != prev.sThumbRY)
+        gamepad->SetStickPosition(port, VirtualStick::Right, pad.sThumbRX / 32767.0f, pad.sThumbRY / 32767.0f);
+}
+
+static void InputThread(HANDLE stop) {
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+    SetCurrentThreadName(L"CitronInput");
+    HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer) timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    LARGE_INTEGER due;
+    due.QuadPart = -10000000LL / INPUT_THREAD_RATE_HZ;
+    if (timer) SetWaitableTimer(timer, &due, std::max(1, 1000 / INPUT_THREAD_RATE_HZ), NULL, NULL, FALSE);
+
+    ControllerSlot slots[MAX_CONTROLLERS];
+    ULONGLONG nextHotplugCheck = 0;
+    HANDLE handles[2] = {stop, timer};
+    // Without a timer each wait on `stop` times out into the next poll.
+    auto nextTick = [&] {
+        if (!timer) return WaitForSingleObject(stop, std::max(1, 1000 / INPUT_THREAD_RATE_HZ)) == WAIT_TIMEOUT;
+        return WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1;
+    };
+    while (nextTick()) {
+        XINPUT_GAMEPAD prev[MAX_CONTROLLERS];
+        for (size_t i = 0; i < MAX_CONTROLLERS; ++i) prev[i] = slots[i].pad;
+        if (!PollControllers(slots, nextHotplugCheck, GetTickCount64())) continue;
+
+        for (size_t i = 0; i < MAX_CONTROLLERS; ++i) {
+            if (memcmp(&slots[i].pad, &prev[i], sizeof(XINPUT_GAMEPAD)) == 0) continue;
+            PushPadToGuest(i, slots[i].pad, prev[i]);
+
+            // Overlay and stop chords; the buttons still reach the guest.
+            WORD held = slots[i].pad.wButtons, was = prev[i].wButtons;
+            auto chord = [&](WORD buttons) { return (held & buttons) == buttons && (was & buttons) != buttons; };
+            if (chord(XINPUT_GAMEPAD_BACK | XINPUT_GAMEPAD_RIGHT_SHOULDER)) PostMessageW(g_MainWindow, WM_APP_OVERLAY_TOGGLE, 0, 0);
+            if (chord(XINPUT_GAMEPAD_BACK | XINPUT_GAMEPAD_LEFT_SHOULDER)) PostMessageW(g_MainWindow, WM_APP_PERF_DUMP, 0, 0);
+            if (chord(XINPUT_GAMEPAD_BACK | XINPUT_GAMEPAD_START)) PostMessageW(g_MainWindow, WM_APP_STOP_TITLE, 0, 0);
+        }
+    }
+
+    if (timer) CloseHandle(timer);
+}
+
+static void StartInputThread() {
+    if (g_InputThread.joinable() || !g_InputSubsystem) return;
+    g_InputStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    g_InputThread = std::thread(InputThread, g_InputStopEvent);
+}
+
+static void StopInputThread() {
+    if (!g_InputThread.joinable()) return;
+    SetEvent(g_InputStopEvent);
+    g_InputThread.join();
+    CloseHandle(g_InputStopEvent);
+    g_InputStopEvent = NULL;
+}
+
+// --- Thread Inspector ---
+// Core threads are found by the names the core gives them. Used by the
+// overlay for per-thread load and by anything that needs to pick out the
+// CPU core, GPU or shader threads.
+enum class ThreadRole { CpuCore, Gpu, ShaderBuilder, Audio, Frontend, Other };
+
+static ThreadRole ClassifyThread(const std::wstring& name) {
+    if (name.rfind(L"CPUCore_", 0) == 0 || name == L"CPUThread") return ThreadRole::CpuCore;
+    if (name.rfind(L"GPU", 0) == 0) return ThreadRole::Gpu;
+    if (name.find(L"ShaderBuilder") != std::wstring::npos || name.find(L"PipelineBuilder") != std::wstring::npos ||
+        name.find(L"ShaderWorker") != std::wstring::npos) return ThreadRole::ShaderBuilder;
+    if (name.find(L"Audio") != std::wstring::npos || name.rfind(L"DSP", 0) == 0) return ThreadRole::Audio;
+    if (name.rfind(L"Citron", 0) == 0) return ThreadRole::Frontend; // named by SetCurrentThreadName()
+    return ThreadRole::Other;
+}
+
+// Calls `fn(tid, name)` for every thread of this process. GetThreadDescription
+// is looked up at runtime; without it every thread reads as unnamed.
+static void EnumerateProcessThreads(const std::function<void(DWORD, const std::wstring&)>& fn) {
+    using GetThreadDescriptionFn = HRESULT(WINAPI*)(HANDLE, PWSTR*);
+    static auto getDescription = reinterpret_cast<GetThreadDescriptionFn>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetThreadDescription"));
+    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snap == INVALID_HANDLE_VALUE) return;
+    DWORD pid = GetCurrentProcessId();
+    THREADENTRY32 te = {sizeof(te)};
+    for (BOOL more = Thread32First(snap, &te); more; more = Thread32Next(snap, &te)) {
+        if (te.th32OwnerProcessID != pid) continue;
+        std::wstring name;
+        if (getDescription) {
+            HANDLE thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, te.th32ThreadID);
+            PWSTR desc = nullptr;
+            if (thread && SUCCEEDED(getDescription(thread, &desc)) && desc) {
+                name = desc;
+                LocalFree(desc);
+            }
+            if (thread) CloseHandle(thread);
+        }
+        fn(te.th32ThreadID, name);
+    }
+    CloseHandle(snap);
+}
+
+// --- Performance Overlay ---
+// While a title runs a sampler thread records a PerfSample every
+// PERF_SAMPLE_MS: frame rate and average frame time from the core's perf
+// stats, per-thread CPU load of the emulator threads, shaders in flight and
+// commit against the job limit. Samples go to a ring
+// buffer that can be dumped to user/perf/*.csv. The overlay is a layered,
+// click-through topmost window drawn from the same ring. Chords on any
+// pad: Back+RB toggles it, Back+LB dumps the CSV.
+const int PERF_SAMPLE_MS = 250;
+const size_t PERF_HISTORY = 4096;      // about 17 minutes at the default rate
+const int PERF_GRAPH_SAMPLES = 120;
+const int PERF_THREAD_REFRESH_MS = 2000; // new threads show up on this cadence
+const int PERF_MAX_CORES = 4;
+const int OVERLAY_WIDTH = 440, OVERLAY_HEIGHT = 300;
+
+struct PerfSample {
+    ULONGLONG tick = 0;
+    float fps = 0;
+    float frametimeMs = 0;
+    float speed = 0;
+    int shadersBuilding = 0;
+    float coreLoad[PERF_MAX_CORES] = {};
+    float gpuLoad = 0;
+    float shaderLoad = 0; // summed over builder threads
+    float audioLoad = 0;  // summed over audio threads
+    uint64_t commit = 0;
+    uint64_t jobLimit = 0;
+};
+
+std::mutex g_PerfMutex; // guards the ring
+std::vector<PerfSample> g_PerfHistory;
+int g_PerfSampleMs = PERF_SAMPLE_MS;      // set before the sampler starts
+size_t g_PerfCapacity = PERF_HISTORY;
+size_t g_PerfNext = 0, g_PerfCount = 0;
+uint32_t g_ShaderStalls = 0;
+std::thread g_PerfThread;
+HANDLE g_PerfStopEvent = NULL;
+HWND g_OverlayWindow = NULL;
+bool g_OverlayVisible = false;
+
+struct SampledThread {
+    HANDLE handle;
+    ThreadRole role;
+    int core; // CPUCore_N index, -1 otherwise
+    uint64_t lastCpu;
+};
+
+static uint64_t GetThreadCpuTime(HANDLE thread) {
+    FILETIME create, exit, kernel, user;
+    if (!GetThreadTimes(thread, &create, &exit, &kernel, &user)) return 0;
+    return ((uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) + ((uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime);
+}
+
+static void RefreshSampledThreads(std::unordered_map<DWORD, SampledThread>& threads) {
+    std::unordered_set<DWORD> alive;
+    EnumerateProcessThreads([&](DWORD tid, const std::wstring& name) {
+        ThreadRole role = ClassifyThread(name);
+        if (role == ThreadRole::Frontend || role == ThreadRole::Other) return;
+        alive.insert(tid);
+        if (threads.count(tid)) return;
+        HANDLE h = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, tid);
+        if (!h) return;
+        int core = name.rfind(L"CPUCore_", 0) == 0 ? _wtoi(name.c_str() + 8) : (role == ThreadRole::CpuCore ? 0 : -1);
+        threads[tid] = {h, role, core, GetThreadCpuTime(h)};
+    });
+    for (auto it = threads.begin(); it != threads.end();) {
+        if (alive.count(it->first)) { ++it; continue; }
+        CloseHandle(it->second.handle);
+        it = threads.erase(it);
+    }
+}
 
-static void ScanGames() {
-    g_Games.clear();
+static void PerfSamplerThread(HANDLE stop) {
+    std::unordered_map<DWORD, SampledThread> threads;
+    ULONGLONG lastRefresh = 0, lastTick = GetTickCount64();
+    g_System->GetAndResetPerfStats();
+    while (WaitForSingleObject(stop, g_PerfSampleMs) == WAIT_TIMEOUT) {
+        ULONGLONG now = GetTickCount64();
+        if (now - lastRefresh >= PERF_THREAD_REFRESH_MS) {
+            RefreshSampledThreads(threads);
+            lastRefresh = now;
+        }
+        PerfSample s;
+        s.tick = now;
+        auto stats = g_System->GetAndResetPerfStats();
+        s.fps = (float)stats.average_game_fps;
+        s.frametimeMs = (float)(stats.frametime * 1000.0);
+        s.speed = (float)(stats.emulation_speed * 100.0);
+        s.shadersBuilding = g_System->GPU().ShaderNotify().ShadersBuilding();
 
-    std::vector<std::filesystem::path> searchPaths;
-    searchPaths.push_back("D:\\Games"); 
+        // Thread times are in 100ns units.
+        double wall = std::max<ULONGLONG>(1, now - lastTick) * 10000.0;
+        for (auto& [tid, t] : threads) {
+            uint64_t cpu = GetThreadCpuTime(t.handle);
+            float load = (float)std::min(100.0, (cpu - t.lastCpu) * 100.0 / wall);
+            t.lastCpu = cpu;
+            if (t.role == ThreadRole::CpuCore && t.core >= 0 && t.core < PERF_MAX_CORES) s.coreLoad[t.core] = load;
+            else if (t.role == ThreadRole::Gpu) s.gpuLoad = std::max(s.gpuLoad, load);
+            else if (t.role == ThreadRole::ShaderBuilder) s.shaderLoad += load;
+            else if (t.role == ThreadRole::Audio) s.audioLoad += load;
+        }
+        lastTick = now;
 
-    // Add user paths
-    for (const auto& p : g_UserGamePaths) {
-        if (fs::exists(p)) {
-            bool found = false;
-            for(const auto& s : searchPaths) if(s == p) found = true;
-            if(!found) searchPaths.push_back(p);
+        auto mem = GetMemoryBudgetSnapshot();
+        s.commit = mem.commit;
+        s.jobLimit = mem.jobLimit;
+        UpdateDynamicResolution(s.frametimeMs, s.gpuLoad, s.shadersBuilding > 0, g_PerfSampleMs);
+        {
+            std::lock_guard lock(g_PerfMutex);
+            // A slow interval with shaders in flight is counted as a compile stall.
+            if (s.shadersBuilding > 0 && s.frametimeMs > 33.4f) g_ShaderStalls++;
+            g_PerfHistory[g_PerfNext] = s;
+            g_PerfNext = (g_PerfNext + 1) % g_PerfCapacity;
+            g_PerfCount = std::min(g_PerfCount + 1, g_PerfCapacity);
         }
+        if (g_OverlayVisible) PostMessageW(g_MainWindow, WM_APP_OVERLAY_SAMPLE, 0, 0);
     }
+    for (auto& [tid, t] : threads) CloseHandle(t.handle);
+}
 
-    // Auto-scan drives
-    for (char letter = 'E'; letter <= 'Z'; ++letter) {
-        std::string drive = ""; drive += letter; drive += ":\\Games";
-        if (fs::exists(drive)) searchPaths.push_back(drive);
+static void StartPerfSampler() {
+    if (g_PerfThread.joinable()) return;
+    {
+        std::lock_guard lock(g_PerfMutex);
+        g_PerfHistory.assign(g_PerfCapacity, PerfSample{});
+        g_PerfNext = g_PerfCount = 0;
+        g_ShaderStalls = 0;
     }
+    g_PerfStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    g_PerfThread = std::thread(PerfSamplerThread, g_PerfStopEvent);
+}
 
-    for (const auto& path : searchPaths) {
-        if (!fs::exists(path)) continue;
-        try {
-            for (const auto& entry : fs::recursive_directory_iterator(path)) {
-                if (entry.is_regular_file()) {
-                    std::string ext = entry.path().extension().string();
-                    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-                    if (ext == ".nsp" || ext == ".xci") {
-                        g_Games.push_back({entry.path().filename().wstring(), entry.path()});
-                    }
-                }
-            }
-        } catch (...) {}
-    }
+static void StopPerfSampler() {
+    if (!g_PerfThread.joinable()) return;
+    SetEvent(g_PerfStopEvent);
+    g_PerfThread.join();
+    CloseHandle(g_PerfStopEvent);
+    g_PerfStopEvent = NULL;
 }
 
-static const size_t MAX_MEMORY_BYTES = 6ULL * 1024 * 1024 * 1024; 
-[[maybe_unused]] static void EnforceMemoryLimit() {
-    HANDLE hJob = CreateJobObject(NULL, NULL);
-    if (hJob) {
-        JOBOBJECT_EXTENDED_LIMIT_INFORMATION jeli = {0};
-        jeli.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_PROCESS_MEMORY;
-        jeli.ProcessMemoryLimit = MAX_MEMORY_BYTES;
-        if (SetInformationJobObject(hJob, JobObjectExtendedLimitInformation, &jeli, sizeof(jeli))) {
-            AssignProcessToJobObject(hJob, GetCurrentProcess());
-        }
+// Copies the newest `max` samples, oldest first.
+static std::vector<PerfSample> GetPerfSamples(size_t max) {
+    std::lock_guard lock(g_PerfMutex);
+    size_t n = std::min(max, g_PerfCount);
+    std::vector<PerfSample> out(n);
+    for (size_t i = 0; i < n; ++i) out[i] = g_PerfHistory[(g_PerfNext + g_PerfCapacity - n + i) % g_PerfCapacity];
+    return out;
+}
+
+static void DumpPerfCsv(HWND hwnd) {
+    auto samples = GetPerfSamples(SIZE_MAX);
+    if (samples.empty()) return;
+    auto dir = GetUserDirectory() / "perf";
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    SYSTEMTIME st;
+    GetLocalTime(&st);
+    uint64_t tid = g_System ? g_System->GetApplicationProcessProgramID() : 0;
+    auto path = dir / fmt::format("{:016X}_{:04}{:02}{:02}-{:02}{:02}{:02}.csv", tid, st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+    std::ofstream out(path, std::ios::trunc);
+    out << "time_ms,fps,frametime_ms,speed_pct,shaders_building";
+    for (int c = 0; c < PERF_MAX_CORES; ++c) out << ",core" << c << "_pct";
+    out << ",gpu_pct,shader_builders_pct,audio_pct,commit_mb,job_limit_mb\n";
+    for (const auto& s : samples) {
+        out << fmt::format("{},{:.2f},{:.2f},{:.1f},{}", s.tick - samples.front().tick, s.fps, s.frametimeMs, s.speed, s.shadersBuilding);
+        for (float load : s.coreLoad) out << fmt::format(",{:.1f}", load);
+        out << fmt::format(",{:.1f},{:.1f},{:.1f},{},{}\n", s.gpuLoad, s.shaderLoad, s.audioLoad, s.commit / MIB, s.jobLimit / MIB);
     }
+    // No message box: it would steal focus from the running title.
+    FlashWindow(hwnd, FALSE);
 }
 
-static void SaveSettings() {
-    auto path = GetConfigPath();
-    // Use std::wfstream for better compatibility
-    std::wofstream file(path);
-    if (!file.is_open()) return;
+struct OverlaySurface {
+    HDC dc = NULL;
+    HBITMAP bitmap = NULL;
+    HGDIOBJ oldBitmap = NULL;
+    void* bits = nullptr;
+    std::unique_ptr<Bitmap> target; // GDI+ view of the DIB, premultiplied ARGB
+    FontFamily family{L"Consolas"};
+    Font font{&family, 14, FontStyleRegular, UnitPixel};
+    SolidBrush panel{Color(190, 16, 16, 16)};
+    SolidBrush text{COLOR_TEXT};
+    SolidBrush dim{COLOR_TEXT_DIM};
+    Pen graph{COLOR_ACCENT, 1.5f};
+    Pen budget{Color(160, 120, 200, 120), 1.0f};
+};
 
-    file << L"[System]" << std::endl;
-    file << L"Language=" << (int)Settings::values.language_index.GetValue() << std::endl;
-    file << L"Region=" << (int)Settings::values.region_index.GetValue() << std::endl;
-    file << L"CustomRTC=" << (Settings::values.custom_rtc_enabled.GetValue() ? 1 : 0) << std::endl;
-    file << L"MultiCore=" << (Settings::values.use_multi_core.GetValue() ? 1 : 0) << std::endl;
-    file << L"MemoryLayout=" << (int)Settings::values.memory_layout_mode.GetValue() << std::endl;
+std::unique_ptr<OverlaySurface> g_OverlaySurface;
 
-    file << std::endl << L"[Paths]" << std::endl;
-    
-    // Deduplicate
-    std::sort(g_UserGamePaths.begin(), g_UserGamePaths.end());
-    g_UserGamePaths.erase(std::unique(g_UserGamePaths.begin(), g_UserGamePaths.end()), g_UserGamePaths.end());
-    
-    for (const auto& p : g_UserGamePaths) {
-        file << L"GamePath=" << p.wstring() << std::endl;
+static void ShowPerfOverlay(bool show) {
+    g_OverlayVisible = show;
+    if (show && !g_OverlayWindow) {
+        WNDCLASSW wc = {};
+        wc.lpfnWndProc = DefWindowProcW;
+        wc.hInstance = GetModuleHandleW(NULL);
+        wc.lpszClassName = L"CitronOverlayWindowClass";
+        RegisterClassW(&wc);
+        // Owned by the main window so it stays above it; never takes focus or clicks.
+        g_OverlayWindow = CreateWindowExW(WS_EX_LAYERED | WS_EX_TRANSPARENT | WS_EX_TOPMOST | WS_EX_NOACTIVATE | WS_EX_TOOLWINDOW,
+                                          wc.lpszClassName, L"", WS_POPUP, 16, 16, OVERLAY_WIDTH, OVERLAY_HEIGHT, g_MainWindow, NULL, wc.hInstance, NULL);
     }
-    file.close();
+    if (!g_OverlayWindow) return;
+    ShowWindow(g_OverlayWindow, show ? SW_SHOWNOACTIVATE : SW_HIDE);
+    if (show) PostMessageW(g_MainWindow, WM_APP_OVERLAY_SAMPLE, 0, 0);
 }
 
-static void LoadSettings() {
-    auto path = GetConfigPath();
-    std::wifstream file(path);
-    if (!file.is_open()) return;
+static void DestroyPerfOverlay() {
+    if (g_OverlayWindow) DestroyWindow(g_OverlayWindow);
+    g_OverlayWindow = NULL;
+    g_OverlayVisible = false;
+    if (g_OverlaySurface && g_OverlaySurface->dc) {
+        g_OverlaySurface->target.reset();
+        SelectObject(g_OverlaySurface->dc, g_OverlaySurface->oldBitmap);
+        DeleteObject(g_OverlaySurface->bitmap);
+        DeleteDC(g_OverlaySurface->dc);
+    }
+    g_OverlaySurface.reset();
+}
+
+static void RenderPerfOverlay() {
+    if (!g_OverlayVisible || !g_OverlayWindow) return;
+    if (!g_OverlaySurface) {
+        auto surface = std::make_unique<OverlaySurface>();
+        BITMAPINFO bi = {};
+        bi.bmiHeader.biSize = sizeof(bi.bmiHeader);
+        bi.bmiHeader.biWidth = OVERLAY_WIDTH;
+        bi.bmiHeader.biHeight = -OVERLAY_HEIGHT;
+        bi.bmiHeader.biPlanes = 1;
+        bi.bmiHeader.biBitCount = 32;
+        bi.bmiHeader.biCompression = BI_RGB;
+        surface->dc = CreateCompatibleDC(NULL);
+        surface->bitmap = CreateDIBSection(surface->dc, &bi, DIB_RGB_COLORS, &surface->bits, NULL, 0);
+        if (!surface->bitmap) { DeleteDC(surface->dc); return; }
+        surface->oldBitmap = SelectObject(surface->dc, surface->bitmap);
+        surface->target = std::make_unique<Bitmap>(OVERLAY_WIDTH, OVERLAY_HEIGHT, OVERLAY_WIDTH * 4, PixelFormat32bppPARGB, static_cast<BYTE*>(surface->bits));
+        g_OverlaySurface = std::move(surface);
+    }
+    OverlaySurface& o = *g_OverlaySurface;
+    auto samples = GetPerfSamples(PERF_GRAPH_SAMPLES);
+    PerfSample last = samples.empty() ? PerfSample{} : samples.back();
+    uint32_t stalls;
+    {
+        std::lock_guard lock(g_PerfMutex);
+        stalls = g_ShaderStalls;
+    }
 
-    g_UserGamePaths.clear(); 
+    Graphics g(o.target.get());
+    g.SetCompositingMode(CompositingModeSourceCopy);
+    g.Clear(Color(0, 0, 0, 0));
+    g.FillRectangle(&o.panel, 0, 0, OVERLAY_WIDTH, OVERLAY_HEIGHT);
+    g.SetCompositingMode(CompositingModeSourceOver);
+    g.SetTextRenderingHint(TextRenderingHintAntiAliasGridFit);
 
-    std::wstring line;
-    while (std::getline(file, line)) {
-        line = Trim(line);
-        if (line.empty() || line[0] == L'[') continue;
+    wchar_t line[160];
+    float y = 8;
+    auto text = [&](const wchar_t* s, const Brush* brush) {
+        g.DrawString(s, -1, &o.font, PointF(10, y), brush);
+        y += 18;
+    };
+    swprintf_s(line, L"FPS %5.1f   %6.2f ms   speed %3.0f%%", last.fps, last.frametimeMs, last.speed);
+    text(line, &o.text);
 
-        size_t eq = line.find(L'=');
-        if (eq != std::wstring::npos) {
-            std::wstring key = Trim(line.substr(0, eq));
-            std::wstring val = Trim(line.substr(eq + 1));
-
-            if (key == L"Language") Settings::values.language_index.SetValue((Settings::Language)_wtoi(val.c_str()));
-            else if (key == L"Region") Settings::values.region_index.SetValue((Settings::Region)_wtoi(val.c_str()));
-            else if (key == L"CustomRTC") Settings::values.custom_rtc_enabled.SetValue(_wtoi(val.c_str()) != 0);
-            else if (key == L"MultiCore") Settings::values.use_multi_core.SetValue(_wtoi(val.c_str()) != 0);
-            else if (key == L"MemoryLayout") Settings::values.memory_layout_mode.SetValue((Settings::MemoryLayout)_wtoi(val.c_str()));
-            else if (key == L"GamePath") {
-                 g_UserGamePaths.push_back(val);
-            }
+    // Frame-time graph, 0-50 ms, with the 60 fps budget marked.
+    RectF graphRect(10, y + 2, OVERLAY_WIDTH - 20, 80);
+    float budgetY = graphRect.Y + graphRect.Height * (1 - 16.7f / 50.0f);
+    g.DrawLine(&o.budget, graphRect.X, budgetY, graphRect.X + graphRect.Width, budgetY);
+    if (samples.size() >= 2) {
+        std::vector<PointF> points(samples.size());
+        for (size_t i = 0; i < samples.size(); ++i) {
+            float v = std::min(samples[i].frametimeMs, 50.0f) / 50.0f;
+            points[i] = PointF(graphRect.X + graphRect.Width * i / (PERF_GRAPH_SAMPLES - 1), graphRect.Y + graphRect.Height * (1 - v));
         }
+        g.DrawLines(&o.graph, points.data(), (INT)points.size());
     }
-    file.close();
+    y += graphRect.Height + 8;
+
+    swprintf_s(line, L"CPU  %3.0f%% %3.0f%% %3.0f%% %3.0f%%", last.coreLoad[0], last.coreLoad[1], last.coreLoad[2], last.coreLoad[3]);
+    text(line, &o.text);
+    swprintf_s(line, L"GPU thread %3.0f%%   shader builders %3.0f%%   audio %3.0f%%", last.gpuLoad, last.shaderLoad, last.audioLoad);
+    text(line, &o.text);
+    swprintf_s(line, L"Shaders building %d   stalls %u", last.shadersBuilding, stalls);
+    text(line, &o.text);
+    if (last.jobLimit) swprintf_s(line, L"Commit %.2f / %.2f GB", last.commit / (double)GIB, last.jobLimit / (double)GIB);
+    else swprintf_s(line, L"Commit %.2f GB (no job limit)", last.commit / (double)GIB);
+    text(line, &o.text);
+    swprintf_s(line, L"ROM cache %.0f%% hit   %llu MB   %llu prefetched", GetRomCacheHitRate(), g_RomCache.Bytes() / MIB,
+               (unsigned long long)g_RomCacheStats.prefetched);
+    text(line, &o.text);
+    auto dynRes = GetDynamicResolution();
+    if (dynRes.enabled) {
+        const auto& scales = PROFILE_FIELDS[(int)ProfileField::Resolution].options;
+        const wchar_t* verdict = dynRes.step < 0 ? L"lower" : dynRes.step > 0 ? L"raise" : L"hold";
+        swprintf_s(line, L"Dyn res %s -> %s next boot (%s)   target %d   GPU %3.0f%%", scales[dynRes.bootIndex],
+                   scales[GetDynResNextIndex(dynRes)], verdict, dynRes.targetFps, dynRes.gpuLoad);
+    } else {
+        wcscpy_s(line, L"Dyn res off");
+    }
+    text(line, &o.text);
+    text(L"Back+RB hide   Back+LB save CSV", &o.dim);
+
+    POINT src = {0, 0};
+    SIZE size = {OVERLAY_WIDTH, OVERLAY_HEIGHT};
+    BLENDFUNCTION blend = {AC_SRC_OVER, 0, 255, AC_SRC_ALPHA};
+    UpdateLayeredWindow(g_OverlayWindow, NULL, NULL, &size, o.dc, &src, 0, &blend, ULW_ALPHA);
 }
 
-static void InstallFilesThread(HWND hwnd, std::wstring sourcePath, std::filesystem::path dest_dir) {
-    g_IsInstalling = true;
-    g_InstallStatus = L"Copying files...";
-    InvalidateRect(hwnd, NULL, FALSE);
-    try {
-        std::filesystem::create_directories(dest_dir);
-        auto options = std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing;
-        std::filesystem::copy(sourcePath, dest_dir, options);
-        g_InstallStatus = L"Done!";
-        MessageBoxW(hwnd, L"Files Copied!", L"Success", MB_OK);
-    } catch (const std::exception& e) {
-        g_InstallStatus = L"Error!";
-        std::string what = e.what();
-        std::wstring wwhat(what.begin(), what.end());
-        MessageBoxW(hwnd, (L"Failed: " + wwhat).c_str(), L"Error", MB_OK);
+// --- Thread Placement ---
+// While a title runs the core's threads are placed by preset; the UI thread
+// drops below normal. Cores are picked one per physical core (SMT siblings
+// stay free): each guest CPU core thread, then the GPU thread, gets its own,
+// and shader builders, audio and our workers share whatever is left. Audio
+// runs above the other shared threads: a mix that misses its slot is an
+// audible underrun, a late shader build only a later pipeline.
+// Soft only sets ideal processors and priorities; Pinned sets hard affinity.
+// Without a physical core to spare after the dedicated ones, only shader
+// builder priorities change.
+// New threads (shader builders start lazily) are picked up every
+// PLACEMENT_REFRESH_MS.
+const int PLACEMENT_REFRESH_MS = 2000;
+
+struct CoreLayout {
+    std::vector<DWORD> dedicated; // logical processor per dedicated thread, in order
+    DWORD_PTR shared = 0;         // affinity for everything else
+};
+
+std::unordered_set<DWORD> g_PlacedThreads; // UI thread only
+bool g_UiThreadLowered = false;
+
+static CoreLayout BuildCoreLayout(size_t dedicatedCount) {
+    CoreLayout layout;
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) return layout;
+
+    DWORD bytes = 0;
+    GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &bytes);
+    std::vector<uint8_t> buffer(bytes);
+    auto* info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+    if (!bytes || !GetLogicalProcessorInformationEx(RelationProcessorCore, info, &bytes)) return layout;
+
+    // Physical cores in the process's group, as masks of their logical processors.
+    std::vector<DWORD_PTR> cores;
+    for (DWORD offset = 0; offset < bytes;) {
+        auto* entry = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+        DWORD_PTR mask = entry->Processor.GroupMask[0].Group == 0 ? entry->Processor.GroupMask[0].Mask & processMask : 0;
+        if (mask) cores.push_back(mask);
+        offset += entry->Size;
     }
-    g_IsInstalling = false;
-    InvalidateRect(hwnd, NULL, FALSE);
+    layout.shared = processMask;
+    if (cores.size() <= dedicatedCount) return layout; // rest needs at least one core
+    for (size_t i = 0; i < dedicatedCount; ++i) {
+        layout.dedicated.push_back((DWORD)std::countr_zero((uint64_t)cores[i]));
+        layout.shared &= ~cores[i];
+    }
+    return layout;
 }
 
-static void InstallFiles(HWND hwnd, const std::wstring& title, const std::filesystem::path& subPath) {
-    if (g_IsInstalling) return;
-    std::filesystem::path dest_dir = GetUserDirectory() / subPath;
-    
-    IFileOpenDialog* pFileOpen;
-    HRESULT hr = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL, IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileOpen));
-    if (SUCCEEDED(hr)) {
-        pFileOpen->SetTitle(title.c_str());
-        pFileOpen->SetOptions(FOS_PICKFOLDERS);
-        if (SUCCEEDED(pFileOpen->Show(hwnd))) {
-            IShellItem* pItem;
-            if (SUCCEEDED(pFileOpen->GetResult(&pItem))) {
-                PWSTR pszFilePath;
-                if (SUCCEEDED(pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath))) {
-                    std::wstring source(pszFilePath);
-                    CoTaskMemFree(pszFilePath);
-                    
-                    if (title == L"Add Game Directory") {
-                        // Store path and save immediately
-                        g_UserGamePaths.push_back(source);
-                        SaveSettings(); 
-                        ScanGames();    
-                        InvalidateRect(hwnd, NULL, FALSE);
-                        MessageBoxW(hwnd, L"Game Directory Saved!", L"Citron", MB_OK);
-                    } else {
-                        std::thread(InstallFilesThread, hwnd, source, dest_dir).detach();
-                    }
-                }
-                pItem->Release();
-            }
+static void PlaceThread(DWORD tid, const std::wstring& name, const CoreLayout& layout, ThreadPlacement preset) {
+    ThreadRole role = ClassifyThread(name);
+    if (role == ThreadRole::Other) return;
+    HANDLE h = OpenThread(THREAD_SET_INFORMATION | THREAD_QUERY_INFORMATION, FALSE, tid);
+    if (!h) return;
+    bool pinned = preset == ThreadPlacement::Pinned && !layout.dedicated.empty();
+    size_t cpuThreads = layout.dedicated.empty() ? 0 : layout.dedicated.size() - 1;
+    int slot = -1;
+    if (role == ThreadRole::CpuCore) slot = name.rfind(L"CPUCore_", 0) == 0 ? _wtoi(name.c_str() + 8) : 0;
+    if (role == ThreadRole::Gpu) slot = (int)cpuThreads;
+
+    if (slot >= 0 && slot < (int)layout.dedicated.size()) {
+        DWORD cpu = layout.dedicated[slot];
+        if (pinned) SetThreadAffinityMask(h, (DWORD_PTR)1 << cpu);
+        else SetThreadIdealProcessor(h, cpu);
+        SetThreadPriority(h, THREAD_PRIORITY_ABOVE_NORMAL);
+    } else if (slot < 0) {
+        if (pinned && layout.shared) SetThreadAffinityMask(h, layout.shared);
+        if (role == ThreadRole::ShaderBuilder) SetThreadPriority(h, THREAD_PRIORITY_BELOW_NORMAL);
+        else if (role == ThreadRole::Audio) SetThreadPriority(h, THREAD_PRIORITY_HIGHEST);
+    }
+    CloseHandle(h);
+}
+
+// Places threads not seen yet; cheap enough to call on a timer while running.
+static void ApplyThreadPlacement() {
+    if (g_ThreadPlacement == ThreadPlacement::Off || g_AppState != AppState::Running) return;
+    static CoreLayout layout;
+    if (g_PlacedThreads.empty()) {
+        size_t cpuThreads = Settings::values.use_multi_core.GetValue() ? Core::Hardware::NUM_CPU_CORES : 1;
+        layout = BuildCoreLayout(cpuThreads + 1);
+        if (!g_UiThreadLowered) {
+            SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+            if (g_ThreadPlacement == ThreadPlacement::Pinned && !layout.dedicated.empty()) SetThreadAffinityMask(GetCurrentThread(), layout.shared);
+            g_UiThreadLowered = true;
         }
-        pFileOpen->Release();
     }
+    EnumerateProcessThreads([&](DWORD tid, const std::wstring& name) {
+        if (g_PlacedThreads.insert(tid).second) PlaceThread(tid, name, layout, g_ThreadPlacement);
+    });
 }
 
-static void RenderUI(HDC hdc, int width, int height) {
-    if (g_AppState == AppState::Running) return;
+static void StartThreadPlacement(HWND hwnd) {
+    g_PlacedThreads.clear();
+    if (g_ThreadPlacement == ThreadPlacement::Off) return;
+    ApplyThreadPlacement();
+    SetTimer(hwnd, PLACEMENT_TIMER, PLACEMENT_REFRESH_MS, NULL);
+}
 
-    Graphics graphics(hdc);
-    graphics.SetSmoothingMode(SmoothingModeAntiAlias);
-    graphics.SetTextRenderingHint(TextRenderingHintClearTypeGridFit);
+// Core threads die with the title; only the UI thread needs putting back.
+static void StopThreadPlacement(HWND hwnd) {
+    KillTimer(hwnd, PLACEMENT_TIMER);
+    g_PlacedThreads.clear();
+    if (!g_UiThreadLowered) return;
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) SetThreadAffinityMask(GetCurrentThread(), processMask);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+    g_UiThreadLowered = false;
+}
 
-    SolidBrush bgBrush(COLOR_BG);
-    graphics.FillRectangle(&bgBrush, 0, 0, width, height);
+// --- Session Lifecycle ---
+// The core has no save states, so a suspend pauses emulation in place and
+// resume continues it; guest memory stays in the process. If the process is
+// terminated while suspended, user/session.ini still names the title and the
+// next launch boots it straight away instead of showing the library.
+struct SessionRecord {
+    std::filesystem::path title;
+};
 
-    FontFamily fontFamily(L"Segoe UI");
-    Font titleFont(&fontFamily, 28, FontStyleBold, UnitPixel);
-    SolidBrush accentBrush(COLOR_ACCENT);
-    SolidBrush textBrush(COLOR_TEXT);
-    StringFormat format;
-    format.SetAlignment(StringAlignmentCenter);
-    format.SetLineAlignment(StringAlignmentCenter);
+bool g_SuspendedByHost = false;
 
-    RectF titleRect(0, 10, (REAL)width, 40);
-    graphics.DrawString(L"CITRON", -1, &titleFont, titleRect, &format, &accentBrush);
+static std::filesystem::path GetSessionPath() {
+    return GetUserDirectory() / "session.ini";
+}
 
-    if (g_IsInstalling) {
-        Font statusFont(&fontFamily, 24, FontStyleRegular, UnitPixel);
-        RectF r(0, (REAL)height / 2, (REAL)width, 50);
-        graphics.DrawString(g_InstallStatus.c_str(), -1, &statusFont, r, &format, &textBrush);
-        return;
+static void WriteSessionRecord(const SessionRecord& record) {
+    WriteFileAtomic(GetSessionPath(), "[Session]\nTitle=" + WideToUtf8(record.title.wstring()) + "\n");
+}
+
+static void ClearSessionRecord() {
+    std::error_code ec;
+    fs::remove(GetSessionPath(), ec);
+}
+
+static std::optional<SessionRecord> ReadSessionRecord() {
+    std::ifstream file(GetSessionPath(), std::ios::binary);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string_view view = TrimView(line);
+        if (view.rfind("Title=", 0) != 0) continue;
+        SessionRecord record{Utf8ToWide(std::string(view.substr(6)))};
+        if (!record.title.empty()) return record;
     }
+    return std::nullopt;
+}
 
-    if (g_AppState == AppState::GameList) {
-        if (g_Games.empty()) {
-            Font msgFont(&fontFamily, 18, FontStyleRegular, UnitPixel);
-            RectF msgRect(0, (REAL)height / 2, (REAL)width, 40);
-            graphics.DrawString(L"No games found.\n1. Settings > Add Game Directory\n2. Settings > Install Prod Keys", -1, &msgFont, msgRect, &format, &textBrush);
-        } else {
-            int visibleItems = (height - 100) / 40;
-            int startIdx = std::max(0, g_SelectedGameIndex - visibleItems / 2);
-            int endIdx = std::min((int)g_Games.size(), startIdx + visibleItems);
-            Font itemFont(&fontFamily, 20, FontStyleRegular, UnitPixel);
-            SolidBrush itemBgBrush(COLOR_ITEM_BG);
-            SolidBrush selBrush(COLOR_ITEM_SELECTED);
-            SolidBrush selTextBrush(COLOR_TEXT_SELECTED);
-            float y = 80;
-            for (int i = startIdx; i < endIdx; ++i) {
-                RectF r(100.0f, y, (REAL)(width - 200), 36.0f);
-                if (i == g_SelectedGameIndex) {
-                    graphics.FillRectangle(&selBrush, r);
-                    graphics.DrawString(g_Games[i].name.c_str(), -1, &itemFont, r, &format, &selTextBrush);
-                } else {
-                    graphics.FillRectangle(&itemBgBrush, r);
-                    graphics.DrawString(g_Games[i].name.c_str(), -1, &itemFont, r, &format, &textBrush);
-                }
-                y += 40;
-            }
-        }
-    } else if (g_AppState == AppState::Settings) {
-        const wchar_t* tabs[] = {L"General", L"System", L"Graphics", L"Audio", L"Network"};
-        float tabW = (float)(width - 40) / 5;
-        Font tabFont(&fontFamily, 16, FontStyleBold, UnitPixel);
-        SolidBrush inactiveBrush(COLOR_TAB_INACTIVE);
+static void OnHostSuspend() {
+    if (g_AppState != AppState::Running || g_SuspendedByHost) return;
+    g_System->Pause();
+    g_SuspendedByHost = true;
+    WriteSessionRecord({g_Boot.path});
+    if (g_MetadataJobs == 0) SaveMetadataCache();
+    SaveSettings();
+}
 
-        for (int i = 0; i < 5; ++i) {
-            RectF r(20 + i * tabW, 60, tabW - 5, 30);
-            if ((int)g_CurrentTab == i) {
-                graphics.FillRectangle(&accentBrush, r);
-                graphics.DrawString(tabs[i], -1, &tabFont, r, &format, &textBrush);
-            } else {
-                graphics.FillRectangle(&inactiveBrush, r);
-                graphics.DrawString(tabs[i], -1, &tabFont, r, &format, &textBrush);
-            }
-        }
-        float contentY = 110;
-        Font labelFont(&fontFamily, 18, FontStyleRegular, UnitPixel);
-        Font valFont(&fontFamily, 18, FontStyleRegular, UnitPixel);
-        StringFormat leftAlign;
-        leftAlign.SetAlignment(StringAlignmentNear);
+static void OnHostResume() {
+    if (!g_SuspendedByHost) return;
+    g_SuspendedByHost = false;
+    ClearSessionRecord();
+    if (g_AppState != AppState::Running) return;
+    // Drop the suspended interval so it doesn't show up as one long frame.
+    g_System->GetAndResetPerfStats();
+    g_System->Run();
+}
 
-        if (g_CurrentTab == SettingsTab::System) {
-             auto GetLangString = [](int index) {
-                switch (index) {
-                case 0: return L"Japanese"; case 1: return L"American English"; case 2: return L"French";
-                case 3: return L"German"; case 4: return L"Italian"; case 5: return L"Spanish";
-                case 6: return L"Chinese"; case 7: return L"Korean"; case 8: return L"Dutch";
-                case 9: return L"Portuguese"; case 10: return L"Russian"; case 11: return L"Taiwanese";
-                case 12: return L"British English"; case 13: return L"Canadian French"; case 14: return L"Latin American Spanish";
-                case 15: return L"Simplified Chinese"; case 16: return L"Traditional Chinese"; case 17: return L"Brazilian Portuguese";
-                default: return L"Unknown";
-                }
-            };
-            struct SysItem { std::wstring label; std::wstring val; };
-            std::vector<SysItem> items = {
-                {L"Language", GetLangString((int)Settings::values.language_index.GetValue())},
-                {L"Region", Settings::values.region_index.GetValue() == Settings::Region::Usa ? L"USA" : L"Other"},
-                {L"Time Zone", L"Auto"},
-                {L"Device Name", std::wstring(Settings::values.device_name.GetValue().begin(), Settings::values.device_name.GetValue().end())},
-                {L"Custom RTC", Settings::values.custom_rtc_enabled.GetValue() ? L"Enabled" : L"Disabled"},
-                {L"RNG Seed", L"00000000"},
-                {L"Multicore CPU", Settings::values.use_multi_core.GetValue() ? L"Enabled" : L"Disabled"},
-                {L"Memory Layout", Settings::values.memory_layout_mode.GetValue() == Settings::MemoryLayout::Memory_4Gb ? L"4GB" : L"6GB"},
-            };
-            for (size_t i = 0; i < items.size(); ++i) {
-                RectF rowRect(40, contentY, (REAL)width - 80, 40);
-                RectF labelRect(rowRect.X + 10, rowRect.Y + 10, 200, 20);
-                RectF valRect(rowRect.X + 250, rowRect.Y + 10, 300, 20);
-                if ((int)i == g_SelectedSettingIndex) {
-                    SolidBrush b = g_IsEditingSetting ? SolidBrush(COLOR_EDITING) : SolidBrush(COLOR_HIGHLIGHT_BROWN);
-                    graphics.FillRectangle(&b, rowRect);
-                } 
-                SolidBrush fieldBrush(COLOR_ITEM_BG);
-                graphics.FillRectangle(&fieldBrush, valRect);
-                std::wstring displayVal = items[i].val;
-                if ((int)i == g_SelectedSettingIndex && g_IsEditingSetting) displayVal = L"< " + displayVal + L" >";
-                graphics.DrawString(items[i].label.c_str(), -1, &labelFont, labelRect, &leftAlign, &textBrush);
-                graphics.DrawString(displayVal.c_str(), -1, &valFont, valRect, &leftAlign, &textBrush);
-                contentY += 50;
-            }
-        } else if (g_CurrentTab == SettingsTab::General) {
-            const wchar_t* actions[] = {L"Install Prod Keys", L"Install Firmware", L"Add Game Directory", L"Install Update (NSP)", L"Install Update (XCI)"};
-            for (int i = 0; i < 5; ++i) {
-                RectF rowRect(40, contentY, (REAL)width - 80, 40);
-                if ((int)i == g_SelectedSettingIndex) {
-                    SolidBrush hlBrush(COLOR_HIGHLIGHT_BROWN);
-                    graphics.FillRectangle(&hlBrush, rowRect);
-                } else {
-                    graphics.FillRectangle(&inactiveBrush, rowRect);
-                }
-                graphics.DrawString(actions[i], -1, &labelFont, rowRect, &format, &textBrush);
-                contentY += 50;
-            }
-        }
+// Called once at startup, after the library scan has started.
+static void ResumeLastSession(HWND hwnd) {
+    auto record = ReadSessionRecord();
+    ClearSessionRecord(); // a title that fails to boot must not come back every launch
+    std::error_code ec;
+    if (!record || !fs::exists(record->title, ec)) return;
+    Game game;
+    game.path = record->title;
+    game.name = record->title.stem().wstring();
+    StartGame(hwnd, game);
+}
+
+// --- Title Teardown ---
+// Back+Start while a title runs returns to the library. The process is shut
+// down on a worker (the renderer still presents to our window until it is
+// gone) while the UI shows Stopping. Initialize() is not repeated: keys, the
+// content provider and the on-disk pipeline caches stay, and only the
+// filesystem factories, which ShutdownMainProcess() drops, are registered
+// again by a warm-up. Guest RAM goes back to the memory budget.
+static void StopTitleThread(HWND hwnd) {
+    TRACE_THREAD_NAME("Stop");
+    TRACE_SCOPE("StopTitle");
+    {
+        std::lock_guard warmLock(g_WarmMutex);
+        std::lock_guard loaderLock(g_LoaderMutex);
+        g_System->SetShuttingDown(true);
+        g_System->ShutdownMainProcess();
+        g_System->SetShuttingDown(false);
+        g_SystemWarm = false;
     }
-    Font hintFont(&fontFamily, 14, FontStyleRegular, UnitPixel);
-    SolidBrush hintBrush(COLOR_TEXT_DIM);
-    RectF fR(20, (REAL)height - 30, (REAL)width, 20);
-    StringFormat fF;
-    fF.SetAlignment(StringAlignmentNear);
-    if (g_AppState == AppState::Settings)
-        graphics.DrawString(L"LB/RB: Tab | A: Select | B: Back", -1, &hintFont, fR, &fF, &hintBrush);
-    else
-        graphics.DrawString(L"A: Play | Start: Settings", -1, &hintFont, fR, &fF, &hintBrush);
+    DeactivateRomCache();
+    ReleaseMemory(MemoryCategory::GuestRam, g_MemoryCharged[(int)MemoryCategory::GuestRam]);
+    CommitDynamicResolution();
+    ClearTitleProfile();
+    PostMessageW(hwnd, WM_APP_STOP_DONE, 0, 0);
 }
 
-static void StartGame(HWND hwnd, const Game& game) {
-    std::filesystem::path root = GetUserDirectory();
+static void StopTitle(HWND hwnd) {
+    if (g_AppState != AppState::Running) return;
+    StopThreadPlacement(hwnd);
+    StopPerfSampler();
+    ShowPerfOverlay(false);
+    StopInputThread();
+    g_SuspendedByHost = false;
+    ClearSessionRecord();
+    g_AppState = AppState::Stopping;
+    InvalidateRect(hwnd, NULL, FALSE);
+    std::thread(StopTitleThread, hwnd).detach();
+}
 
-    // 1. Check for Keys (UI Check)
-    std::filesystem::path keyPath = root / "keys/prod.keys";
-    if (!fs::exists(keyPath)) {
-        std::wstring msg = L"prod.keys MISSING!\nLocation:\n" + keyPath.wstring() + L"\n\nPlease use Settings > Install Prod Keys";
-        MessageBoxW(hwnd, msg.c_str(), L"Missing Files", MB_ICONERROR);
-        return;
-    }
+static void OnStopDone(HWND hwnd) {
+    g_AppState = AppState::GameList;
+    StartWarmup();
+    InvalidateRect(hwnd, NULL, FALSE);
+}
 
-    // 2. Check for Firmware (UI Check)
-    std::filesystem::path nandPath = root / "nand/system/Contents/registered";
-    bool hasFirmware = false;
-    if (fs::exists(nandPath)) {
-        for (const auto& entry : fs::directory_iterator(nandPath)) {
-            if (entry.path().extension() == ".nca") {
-                hasFirmware = true;
-                break;
-            }
-        }
-    }
-    if (!hasFirmware) {
-        std::wstring msg = L"Firmware MISSING!\nLocation:\n" + nandPath.wstring() + L"\n\nFolder must contain .nca files.\nPlease use Settings > Install Firmware";
-        MessageBoxW(hwnd, msg.c_str(), L"Missing Files", MB_ICONERROR);
-        return;
-    }
+// --- Benchmark Mode ---
+// citron --benchmark <title> [--duration <s>] [--profile <ini>] [--output <json>]
+// boots the title through StartGame() with no library scan and no menu
+// input, samples for the duration and writes a JSON report, then exits with
+// 0 on a completed run, 1 when the boot failed and 2 on bad arguments.
+// Percentiles are over perf-stat intervals of BENCHMARK_SAMPLE_MS, which is
+// the finest frame timing the core exposes.
+const int BENCHMARK_SAMPLE_MS = 50;
 
-    try {
-        if (!g_System) g_System = std::make_unique<Core::System>();
-        if (!g_EmuWindow) g_EmuWindow = std::make_unique<XboxEmuWindow>(hwnd);
+static std::string JsonEscape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+        else if (c < 0x20) out += fmt::format("\\u{:04x}", c);
+        else out += (char)c;
+    }
+    return out;
+}
 
-        // Core Configuration
-        Settings::values.renderer_backend.SetValue(Settings::RendererBackend::D3D12);
-        Settings::values.use_disk_shader_cache.SetValue(true);
-        Settings::values.use_asynchronous_gpu_emulation.SetValue(true);
-        
-        g_System->Initialize();
-        g_System->SetContentProvider(std::make_unique<FileSys::ContentProviderUnion>());
-        g_System->SetFilesystem(std::make_shared<FileSys::RealVfsFilesystem>());
+static bool ParseBenchmarkArgs(PWSTR cmdLine) {
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(cmdLine, &argc);
+    if (!argv) return true;
+    bool ok = true;
+    for (int i = 0; i < argc; ++i) {
+        std::wstring arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == L"--benchmark" && hasValue) { g_Benchmark.active = true; g_Benchmark.title = argv[++i]; }
+        else if (arg == L"--duration" && hasValue) g_Benchmark.durationSec = _wtoi(argv[++i]);
+        else if (arg == L"--profile" && hasValue) g_Benchmark.profile = argv[++i];
+        else if (arg == L"--output" && hasValue) g_Benchmark.output = argv[++i];
+        else if (i > 0 || arg.rfind(L"--", 0) == 0) ok = false; // argv[0] may be the program path
+    }
+    LocalFree(argv);
+    if (!g_Benchmark.active) return ok;
+    if (g_Benchmark.output.empty()) g_Benchmark.output = GetUserDirectory() / "perf" / "benchmark.json";
+    return ok && g_Benchmark.durationSec > 0 && (g_Benchmark.profile.empty() || fs::exists(g_Benchmark.profile));
+}
 
-        Service::AM::FrontendAppletParameters params{};
-        params.launch_type = Service::AM::LaunchType::FrontendInitiated;
+// Nearest-rank percentile of an ascending list.
+static float Percentile(const std::vector<float>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
 
-        Core::SystemResultStatus load_result = g_System->Load(*g_EmuWindow, game.path.string(), params);
+static void WriteBenchmarkReport(const wchar_t* error) {
+    auto samples = GetPerfSamples(SIZE_MAX);
+    std::vector<float> frametimes;
+    double fpsSum = 0;
+    int peakShaders = 0;
+    uint32_t stalls = 0;
+    for (const auto& s : samples) {
+        if (s.frametimeMs > 0) frametimes.push_back(s.frametimeMs);
+        fpsSum += s.fps;
+        peakShaders = std::max(peakShaders, s.shadersBuilding);
+        if (s.shadersBuilding > 0 && s.frametimeMs > 33.4f) stalls++;
+    }
+    std::sort(frametimes.begin(), frametimes.end());
+    auto mem = GetMemoryBudgetSnapshot();
+    uint64_t titleId = g_System && !error ? g_System->GetApplicationProcessProgramID() : 0;
 
-        if (load_result != Core::SystemResultStatus::Success) {
-            std::string err = fmt::format("Boot Failed Error Code: {}", (int)load_result);
-            std::wstring werr(err.begin(), err.end());
-            MessageBoxW(hwnd, werr.c_str(), L"Boot Error", MB_OK);
-            return;
-        }
+    std::string json = "{\n";
+    json += fmt::format("  \"title\": \"{}\",\n", JsonEscape(WideToUtf8(g_Benchmark.title.wstring())));
+    json += fmt::format("  \"title_id\": \"{:016X}\",\n", titleId);
+    json += fmt::format("  \"profile\": \"{}\",\n", JsonEscape(WideToUtf8(g_Benchmark.profile.wstring())));
+    json += fmt::format("  \"result\": \"{}\",\n", error ? "failed" : "completed");
+    if (error) json += fmt::format("  \"error\": \"{}\",\n", JsonEscape(WideToUtf8(error)));
+    json += fmt::format("  \"duration_s\": {},\n", g_Benchmark.durationSec);
+    json += fmt::format("  \"sample_interval_ms\": {},\n", g_PerfSampleMs);
+    json += fmt::format("  \"samples\": {},\n", samples.size());
+    json += "  \"boot_ms\": {";
+    for (int i = 0; i < (int)BootStage::Count; ++i)
+        json += fmt::format("{}\"{}\": {}", i ? ", " : "", JsonEscape(WideToUtf8(BOOT_STAGE_NAMES[i])), g_Boot.stageMs[i]);
+    json += "},\n";
+    json += fmt::format("  \"fps_avg\": {:.2f},\n", samples.empty() ? 0.0 : fpsSum / samples.size());
+    json += fmt::format("  \"frametime_ms\": {{\"p50\": {:.2f}, \"p90\": {:.2f}, \"p99\": {:.2f}, \"p99_9\": {:.2f}, \"max\": {:.2f}}},\n",
+                        Percentile(frametimes, 50), Percentile(frametimes, 90), Percentile(frametimes, 99), Percentile(frametimes, 99.9),
+                        frametimes.empty() ? 0.0f : frametimes.back());
+    json += fmt::format("  \"shaders\": {{\"prewarmed\": {}, \"peak_building\": {}, \"stall_intervals\": {}}},\n", g_Boot.shadersLoaded, peakShaders, stalls);
+    json += fmt::format("  \"rom_cache\": {{\"hit_rate\": {:.1f}, \"hits\": {}, \"misses\": {}, \"prefetched\": {}, \"prefetch_hits\": {}, \"bypass_mb\": {}}},\n",
+                        GetRomCacheHitRate(), g_RomCacheStats.hits.load(), g_RomCacheStats.misses.load(), g_RomCacheStats.prefetched.load(),
+                        g_RomCacheStats.prefetchHits.load(), g_RomCacheStats.bypassBytes / MIB);
+    json += fmt::format("  \"memory_mb\": {{\"peak_commit\": {}, \"job_limit\": {}}}\n", mem.peakCommit / MIB, mem.jobLimit / MIB);
+    json += "}\n";
 
-        g_System->GPU().Start();
-        g_System->GetCpuManager().OnGpuReady();
+    std::error_code ec;
+    fs::create_directories(g_Benchmark.output.parent_path(), ec);
+    auto tmp = g_Benchmark.output;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out << json;
+        if (!out) return;
+    }
+    fs::rename(tmp, g_Benchmark.output, ec);
+}
 
-        g_AppState = AppState::Running;
-        InvalidateRect(hwnd, NULL, FALSE);
-        g_System->Run();
-    } catch (const std::exception& e) {
-        std::string err = fmt::format("Crash: {}", e.what());
-        std::wstring werr(err.begin(), err.end());
-        MessageBoxW(hwnd, werr.c_str(), L"Critical Error", MB_OK | MB_ICONERROR);
+// Runs on the UI thread once the timer fires or the boot fails.
+static void FinishBenchmark(HWND hwnd, const wchar_t* error) {
+    KillTimer(hwnd, BENCHMARK_TIMER);
+    StopPerfSampler();
+    WriteBenchmarkReport(error);
+    g_Benchmark.exitCode = error ? 1 : 0;
+    if (g_AppState == AppState::Running) {
+        StopThreadPlacement(hwnd);
+        StopInputThread();
+        g_System->SetShuttingDown(true);
+        g_System->ShutdownMainProcess();
     }
+    DestroyWindow(hwnd);
+}
+
+static LONG GetInputPollPeriodMs() {
+    if (g_AppState == AppState::Running) return 0;
+    return std::max(1, 1000 / std::max(1, g_MenuPollRate));
 }
 
 static void HandleInput(HWND hwnd) {
+    if (g_Benchmark.active) return;
     ULONGLONG currentTime = GetTickCount64();
-    XINPUT_STATE state;
-    bool up = false, down = false, lb = false, rb = false, a_btn = false, b_btn = false, start = false;
+    bool up = false, down = false, lb = false, rb = false, a_btn = false, b_btn = false, y_btn = false, start = false;
+    bool lt = false, rt = false, x_btn = false, back = false;
     bool any_connected = false;
 
+    // Nothing new and nothing held: no repeat to fire either.
+    if (!PollControllers(g_Controllers, g_NextHotplugCheck, currentTime) && g_LastInputMask == 0) return;
+
     for (DWORD i = 0; i < MAX_CONTROLLERS; ++i) {
-        if (XInputGetState(i, &state) == ERROR_SUCCESS) {
+        if (g_Controllers[i].connected) {
             any_connected = true;
-            short ly = state.Gamepad.sThumbLY;
-            WORD btns = state.Gamepad.wButtons;
+            short ly = g_Controllers[i].pad.sThumbLY;
+            WORD btns = g_Controllers[i].pad.wButtons;
             if ((btns & XINPUT_GAMEPAD_DPAD_UP) || (ly > INPUT_DEADZONE)) up = true;
             if ((btns & XINPUT_GAMEPAD_DPAD_DOWN) || (ly < -INPUT_DEADZONE)) down = true;
             if (btns & XINPUT_GAMEPAD_LEFT_SHOULDER) lb = true;
             if (btns & XINPUT_GAMEPAD_RIGHT_SHOULDER) rb = true;
             if (btns & XINPUT_GAMEPAD_A) a_btn = true;
             if (btns & XINPUT_GAMEPAD_B) b_btn = true;
+            if (btns & XINPUT_GAMEPAD_Y) y_btn = true;
             if (btns & XINPUT_GAMEPAD_START) start = true;
+            if (btns & XINPUT_GAMEPAD_X) x_btn = true;
+            if (btns & XINPUT_GAMEPAD_BACK) back = true;
+            if (g_Controllers[i].pad.bLeftTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD) lt = true;
+            if (g_Controllers[i].pad.bRightTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD) rt = true;
         }
     }
 
@@ -546,6 +5389,11 @@ static void HandleInput(HWND hwnd) {
     if (a_btn) currentMask |= 16;
     if (b_btn) currentMask |= 32;
     if (start) currentMask |= 64;
+    if (y_btn) currentMask |= 128;
+    if (lt) currentMask |= 256;
+    if (rt) currentMask |= 512;
+    if (x_btn) currentMask |= 1024;
+    if (back) currentMask |= 2048;
 
     bool execute = false;
     if (currentMask != 0) {
@@ -562,17 +5410,75 @@ static void HandleInput(HWND hwnd) {
     if (!execute) return;
 
     if (any_connected) {
-        if (g_AppState == AppState::GameList) {
+        if (g_AppState == AppState::Booting) {
+            if (b_btn && !g_BootCancel) { g_BootCancel = true; InvalidateRect(hwnd, NULL, FALSE); }
+        } else if (g_AppState == AppState::GameList) {
             if (start) {
                 g_AppState = AppState::Settings;
                 g_CurrentTab = SettingsTab::General;
                 g_SelectedSettingIndex = 0;
                 InvalidateRect(hwnd, NULL, FALSE);
             }
-            if (!g_Games.empty()) {
-                if (up && g_SelectedGameIndex > 0) { g_SelectedGameIndex--; InvalidateRect(hwnd, NULL, FALSE); }
-                if (down && g_SelectedGameIndex < (int)g_Games.size() - 1) { g_SelectedGameIndex++; InvalidateRect(hwnd, NULL, FALSE); }
-                if (a_btn && g_SelectedGameIndex >= 0) StartGame(hwnd, g_Games[g_SelectedGameIndex]);
+            RebuildGameOrder();
+            if (x_btn) {
+                g_GameSort = (GameSort)(((int)g_GameSort + 1) % (int)GameSort::Count);
+                InvalidateGameOrder(false);
+                RebuildGameOrder();
+                InvalidateRect(hwnd, NULL, FALSE);
+            }
+            if (back && g_GameSort == GameSort::Name && !g_GameOrder.empty()) {
+                // Narrow to the selected game's initial, or widen back to everything.
+                int pos = GetGameViewBegin() + g_SelectedGameIndex;
+                g_LetterFilter = g_LetterFilter < 0 ? GetLetterBucket(g_Games[g_GameOrder[pos]]) : -1;
+                g_SelectedGameIndex = pos - GetGameViewBegin();
+                g_GameListTop = 0;
+                InvalidateRect(hwnd, NULL, FALSE);
+            }
+            int count = GetGameViewCount();
+            if (count > 0) {
+                RECT rc; GetClientRect(hwnd, &rc);
+                int page = GetGameListVisibleRows(rc.bottom);
+                if (up && g_SelectedGameIndex > 0) MoveSelection(hwnd, g_SelectedGameIndex, g_SelectedGameIndex - 1);
+                if (down && g_SelectedGameIndex < count - 1) MoveSelection(hwnd, g_SelectedGameIndex, g_SelectedGameIndex + 1);
+                if (lt) MoveSelection(hwnd, g_SelectedGameIndex, std::max(0, g_SelectedGameIndex - page));
+                if (rt) MoveSelection(hwnd, g_SelectedGameIndex, std::min(count - 1, g_SelectedGameIndex + page));
+                if ((lb || rb) && g_GameSort == GameSort::Name && g_LetterFilter < 0) {
+                    // Start of the previous/next non-empty initial.
+                    int bucket = GetLetterBucket(GetViewGame(g_SelectedGameIndex));
+                    int target = g_SelectedGameIndex;
+                    if (rb) {
+                        for (int b = bucket + 1; b < LETTER_BUCKETS; ++b)
+                            if (g_LetterStart[b + 1] > g_LetterStart[b]) { target = g_LetterStart[b]; break; }
+                    } else if (g_SelectedGameIndex > g_LetterStart[bucket]) {
+                        target = g_LetterStart[bucket];
+                    } else {
+                        for (int b = bucket - 1; b >= 0; --b)
+                            if (g_LetterStart[b + 1] > g_LetterStart[b]) { target = g_LetterStart[b]; break; }
+                    }
+                    MoveSelection(hwnd, g_SelectedGameIndex, target);
+                }
+                if (a_btn) StartGame(hwnd, GetViewGame(g_SelectedGameIndex));
+                else if (y_btn) OpenTitleProfile(hwnd, GetViewGame(g_SelectedGameIndex));
+            }
+        } else if (g_AppState == AppState::Profile) {
+            if (!g_IsEditingSetting) {
+                if (b_btn) {
+                    SaveTitleProfile(g_EditingProfileTitleId, g_EditingProfile);
+                    g_AppState = AppState::GameList;
+                    InvalidateRect(hwnd, NULL, FALSE);
+                }
+                if (up && g_SelectedSettingIndex > 0) MoveSelection(hwnd, g_SelectedSettingIndex, g_SelectedSettingIndex - 1);
+                if (down && g_SelectedSettingIndex < PROFILE_FIELD_COUNT - 1) MoveSelection(hwnd, g_SelectedSettingIndex, g_SelectedSettingIndex + 1);
+                if (a_btn) { g_IsEditingSetting = true; InvalidateRow(hwnd, g_SelectedSettingIndex); }
+            } else {
+                if (b_btn || a_btn) { g_IsEditingSetting = false; InvalidateRow(hwnd, g_SelectedSettingIndex); }
+                if (up || down || lb || rb) {
+                    // -1 (Global) is part of the cycle.
+                    int n = (int)PROFILE_FIELDS[g_SelectedSettingIndex].options.size() + 1;
+                    int& v = g_EditingProfile.values[g_SelectedSettingIndex];
+                    v = (v + 1 + ((up || rb) ? 1 : -1) + n) % n - 1;
+                    InvalidateRow(hwnd, g_SelectedSettingIndex);
+                }
             }
         } else if (g_AppState == AppState::Settings) {
             if (!g_IsEditingSetting) {
@@ -589,35 +5495,57 @@ static void HandleInput(HWND hwnd) {
                     int t = (int)g_CurrentTab + 1; if (t > 4) t = 0;
                     g_CurrentTab = (SettingsTab)t; g_SelectedSettingIndex = 0; InvalidateRect(hwnd, NULL, FALSE);
                 }
+                if ((lb || rb) && g_CurrentTab == SettingsTab::Graphics) RefreshShaderCaches();
+                if ((lb || rb) && g_CurrentTab == SettingsTab::Audio) RefreshAudioDevices();
 
-                int limit = (g_CurrentTab == SettingsTab::System) ? 8 : (g_CurrentTab == SettingsTab::General ? 5 : 0);
-                if (up && g_SelectedSettingIndex > 0) { g_SelectedSettingIndex--; InvalidateRect(hwnd, NULL, FALSE); }
-                if (down && g_SelectedSettingIndex < limit - 1) { g_SelectedSettingIndex++; InvalidateRect(hwnd, NULL, FALSE); }
+                int limit = (g_CurrentTab == SettingsTab::System) ? SYSTEM_ITEM_COUNT : (g_CurrentTab == SettingsTab::General ? 5 : 0);
+                if (g_CurrentTab == SettingsTab::Graphics) limit = GRAPHICS_FIXED_ROWS + (int)g_ShaderCaches.size();
+                if (g_CurrentTab == SettingsTab::Audio) limit = AUDIO_ITEM_COUNT;
+                if (up && g_SelectedSettingIndex > 0) MoveSelection(hwnd, g_SelectedSettingIndex, g_SelectedSettingIndex - 1);
+                if (down && g_SelectedSettingIndex < limit - 1) MoveSelection(hwnd, g_SelectedSettingIndex, g_SelectedSettingIndex + 1);
 
                 if (a_btn) {
                     if (g_CurrentTab == SettingsTab::General) {
                         if (g_SelectedSettingIndex == 0) InstallFiles(hwnd, L"Select Keys Folder", "keys");
                         if (g_SelectedSettingIndex == 1) InstallFiles(hwnd, L"Select Firmware Folder", "nand/system/Contents/registered");
                         if (g_SelectedSettingIndex == 2) InstallFiles(hwnd, L"Add Game Directory", "");
+                        if (g_SelectedSettingIndex == 3) InstallPackages(hwnd, false);
+                        if (g_SelectedSettingIndex == 4) InstallPackages(hwnd, true);
+                    } else if (g_CurrentTab == SettingsTab::Graphics) {
+                        if (g_SelectedSettingIndex == 0) g_PrewarmShaders = !g_PrewarmShaders;
+                        else if (g_SelectedSettingIndex == 1) {
+                            g_UiRenderer = g_UiRenderer == UiRendererKind::Direct2D ? UiRendererKind::GdiPlus : UiRendererKind::Direct2D;
+                            // Falls back to GDI+ (and shows it) if Direct2D can't start.
+                            InitUiCanvas();
+                        }
+                        else if (g_SelectedSettingIndex == 2) PurgeStaleShaderCaches(hwnd);
+                        else PurgeShaderCache(hwnd, g_SelectedSettingIndex - GRAPHICS_FIXED_ROWS);
+                        g_SelectedSettingIndex = std::min(g_SelectedSettingIndex, GRAPHICS_FIXED_ROWS + (int)g_ShaderCaches.size() - 1);
+                        InvalidateRect(hwnd, NULL, FALSE);
+                    } else if (g_CurrentTab == SettingsTab::Audio) {
+                        g_IsEditingSetting = true; InvalidateRow(hwnd, g_SelectedSettingIndex);
                     } else if (g_CurrentTab == SettingsTab::System) {
-                        if (g_SelectedSettingIndex == 0 || g_SelectedSettingIndex == 1 || g_SelectedSettingIndex == 4 || g_SelectedSettingIndex == 6 || g_SelectedSettingIndex == 7) {
-                            g_IsEditingSetting = true; InvalidateRect(hwnd, NULL, FALSE);
+                        if (g_SelectedSettingIndex == 0 || g_SelectedSettingIndex == 1 || g_SelectedSettingIndex == 4 || g_SelectedSettingIndex == 6 || g_SelectedSettingIndex == 7 || g_SelectedSettingIndex == 8 || g_SelectedSettingIndex == 9) {
+                            g_IsEditingSetting = true; InvalidateRow(hwnd, g_SelectedSettingIndex);
                         }
                     }
                 }
             } else {
-                if (b_btn || a_btn) { g_IsEditingSetting = false; InvalidateRect(hwnd, NULL, FALSE); }
-                if (up || down || lb || rb) {
+                if (b_btn || a_btn) { g_IsEditingSetting = false; InvalidateRow(hwnd, g_SelectedSettingIndex); }
+                if ((up || down || lb || rb) && g_CurrentTab == SettingsTab::Audio) {
+                    StepAudioItem(g_SelectedSettingIndex, (up || rb) ? 1 : -1);
+                    InvalidateRow(hwnd, g_SelectedSettingIndex);
+                } else if (up || down || lb || rb) {
                     switch (g_SelectedSettingIndex) {
                     case 0: { 
                         int lang = (int)Settings::values.language_index.GetValue();
-                        lang = (lang + (up ? 1 : -1) + 18) % 18;
+                        lang = (lang + (up ? 1 : -1) + LANGUAGE_COUNT) % LANGUAGE_COUNT;
                         Settings::values.language_index.SetValue((Settings::Language)lang);
                         break; 
                     }
                     case 1: {
                         int reg = (int)Settings::values.region_index.GetValue();
-                        reg = (reg + (up ? 1 : -1) + 6) % 6;
+                        reg = (reg + (up ? 1 : -1) + REGION_COUNT) % REGION_COUNT;
                         Settings::values.region_index.SetValue((Settings::Region)reg);
                         break;
                     }
@@ -628,8 +5556,21 @@ static void HandleInput(HWND hwnd) {
                         Settings::values.memory_layout_mode.SetValue(c == Settings::MemoryLayout::Memory_4Gb ? Settings::MemoryLayout::Memory_6Gb : Settings::MemoryLayout::Memory_4Gb);
                         break;
                     }
+                    case 8: {
+                        const int rates[] = {60, 120, 250};
+                        int idx = 0;
+                        while (idx < 2 && rates[idx] < g_MenuPollRate) idx++;
+                        idx = (idx + (up ? 1 : -1) + 3) % 3;
+                        g_MenuPollRate = rates[idx];
+                        break;
                     }
-                    InvalidateRect(hwnd, NULL, FALSE);
+                    case 9: {
+                        int n = (int)ThreadPlacement::Count;
+                        g_ThreadPlacement = (ThreadPlacement)(((int)g_ThreadPlacement + (up ? 1 : -1) + n) % n);
+                        break;
+                    }
+                    }
+                    InvalidateRow(hwnd, g_SelectedSettingIndex);
                 }
             }
         }
@@ -640,19 +5581,121 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     switch (uMsg) {
     case WM_PAINT: {
         PAINTSTRUCT ps;
+        TRACE_SCOPE_ONCE("First WM_PAINT");
         HDC hdc = BeginPaint(hwnd, &ps);
-        RECT rc; GetClientRect(hwnd, &rc);
-        HDC memDC = CreateCompatibleDC(hdc);
-        HBITMAP memBitmap = CreateCompatibleBitmap(hdc, rc.right, rc.bottom);
-        SelectObject(memDC, memBitmap);
-        RenderUI(memDC, rc.right, rc.bottom);
-        BitBlt(hdc, 0, 0, rc.right, rc.bottom, memDC, 0, 0, SRCCOPY);
-        DeleteObject(memBitmap); DeleteDC(memDC); EndPaint(hwnd, &ps);
+        // While a title runs the renderer owns the window surface.
+        UiCanvas* canvas = GetActiveCanvas();
+        if (canvas && g_AppState != AppState::Running) canvas->Paint(hwnd, hdc, ps.rcPaint);
+        EndPaint(hwnd, &ps);
         return 0;
     }
+    case WM_SIZE:
+        if (g_GdiCanvas) g_GdiCanvas->Resize(hwnd);
+        if (g_D2DCanvas) g_D2DCanvas->Resize(hwnd);
+        InvalidateRect(hwnd, NULL, FALSE);
+        return 0;
     case WM_ERASEBKGND: return 1;
+    case WM_APP_SCAN_BATCH: {
+        std::unique_ptr<ScanBatch> batch(reinterpret_cast<ScanBatch*>(lParam));
+        if (batch->generation == g_ScanGeneration) {
+            for (auto& game : batch->games) AddGameToList(std::move(game));
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+        return 0;
+    }
+    case WM_APP_INSTALL_DONE:
+        OnInstallDone(hwnd, std::unique_ptr<InstallResult>(reinterpret_cast<InstallResult*>(lParam)));
+        return 0;
+    case WM_APP_BOOT_STAGE:
+        OnBootStage(hwnd, (int)wParam, (ULONGLONG)lParam);
+        return 0;
+    case WM_APP_BOOT_PROGRESS:
+        g_Boot.progress = (size_t)wParam;
+        g_Boot.progressTotal = (size_t)lParam;
+        if (g_Boot.stage == (int)BootStage::LoadShaders) g_Boot.shadersLoaded = g_Boot.progress;
+        return 0;
+    case WM_APP_BOOT_DONE:
+        OnBootDone(hwnd, (BootResult)wParam, std::unique_ptr<BootError>(reinterpret_cast<BootError*>(lParam)));
+        return 0;
+    case WM_APP_OVERLAY_SAMPLE:
+        RenderPerfOverlay();
+        return 0;
+    case WM_APP_OVERLAY_TOGGLE:
+        if (g_AppState == AppState::Running) ShowPerfOverlay(!g_OverlayVisible);
+        return 0;
+    case WM_APP_PERF_DUMP:
+        DumpPerfCsv(hwnd);
+        return 0;
+    case WM_APP_STOP_TITLE:
+        if (!g_Benchmark.active) StopTitle(hwnd);
+        return 0;
+    case WM_APP_STOP_DONE:
+        OnStopDone(hwnd);
+        return 0;
+    case WM_TIMER:
+        if (wParam == BOOT_REFRESH_TIMER || wParam == INSTALL_REFRESH_TIMER) InvalidateRect(hwnd, NULL, FALSE);
+        if (wParam == BENCHMARK_TIMER) FinishBenchmark(hwnd, nullptr);
+        if (wParam == PLACEMENT_TIMER) ApplyThreadPlacement();
+        if (wParam == GAME_ORDER_TIMER) {
+            KillTimer(hwnd, GAME_ORDER_TIMER);
+            g_GameOrderBatchPending = false;
+            InvalidateGameOrder(false);
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+        return 0;
+    case WM_APP_METADATA:
+        OnMetadataResult(std::unique_ptr<TitleMetadata>(reinterpret_cast<TitleMetadata*>(lParam)));
+        InvalidateRect(hwnd, NULL, FALSE);
+        return 0;
+    case WM_APP_METADATA_IDLE:
+        SaveMetadataCache();
+        return 0;
+    case WM_APP_MEMORY_TRIM:
+        if (g_MetadataJobs == 0) SaveMetadataCache();
+        return 0;
+    case WM_APP_LIBRARY_CHANGE: {
+        std::unique_ptr<LibraryChange> change(reinterpret_cast<LibraryChange*>(lParam));
+        if (change->generation == g_ScanGeneration) {
+            for (const auto& p : change->removed) RemoveGamesUnder(p);
+            for (auto& game : change->added) AddGameToList(std::move(game));
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+        return 0;
+    }
+    case WM_POWERBROADCAST:
+        if (wParam == PBT_APMSUSPEND) OnHostSuspend();
+        if (wParam == PBT_APMRESUMEAUTOMATIC || wParam == PBT_APMRESUMESUSPEND) OnHostResume();
+        return TRUE;
+    case WM_DEVICECHANGE: {
+        auto* hdr = reinterpret_cast<DEV_BROADCAST_HDR*>(lParam);
+        if (!hdr) return TRUE;
+        if (hdr->dbch_devicetype == DBT_DEVTYP_HANDLE) {
+            // A watched root's drive is being ejected: let go of it, and watch it
+            // again if the removal is vetoed by someone else.
+            if (wParam == DBT_DEVICEQUERYREMOVE) ReleaseWatchedHandle(reinterpret_cast<DEV_BROADCAST_HANDLE*>(hdr)->dbch_handle);
+            if (wParam == DBT_DEVICEQUERYREMOVEFAILED) StartLibraryWatcher(g_SearchRoots, g_ScanGeneration);
+        } else if (hdr->dbch_devicetype == DBT_DEVTYP_VOLUME && (wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE)) {
+            OnDriveChange(reinterpret_cast<DEV_BROADCAST_VOLUME*>(hdr)->dbcv_unitmask, wParam == DBT_DEVICEARRIVAL);
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+        return TRUE;
+    }
+    case WM_APP_SCAN_DONE:
+        if (g_MetadataJobs == 0) SaveMetadataCache();
+        InvalidateRect(hwnd, NULL, FALSE);
+        return 0;
     case WM_DESTROY:
+        ClearSessionRecord();
+        StopInputThread();
+        StopPerfSampler();
+        CommitDynamicResolution();
+        DestroyPerfOverlay();
+        StopLibraryWatcher();
+        g_MetadataPool.reset();
+        SaveMetadataCache();
+        UnmapIconBlob();
         SaveSettings();
+        FlushSettings();
         PostQuitMessage(0);
         return 0;
     }
@@ -661,6 +5704,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow) {
     CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+    TRACE_THREAD_NAME("UI");
+    TRACE_NAMED_SCOPE(startup, "GetUserDirectory");
 
     // CRITICAL: Force Env Vars to Writable Location
     std::filesystem::path userDir = GetUserDirectory();
@@ -674,9 +5719,20 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
     SetEnvironmentVariableW(L"XDG_CONFIG_HOME", userDirStr.c_str());
 
     GdiplusStartupInput gdiplusStartupInput;
+    if (!ParseBenchmarkArgs(pCmdLine)) return 2;
+
+#ifndef NDEBUG
+    if (!CheckNczDecode()) MessageBoxW(NULL, L"NCZ decode self-check failed.\nCompressed packages may not load correctly.", L"Error", MB_OK);
+#endif
+
+    TRACE_NEXT(startup, "GdiplusStartup");
     GdiplusStartup(&g_gdiplusToken, &gdiplusStartupInput, NULL);
-    EnforceMemoryLimit();
+    TRACE_NEXT(startup, "LoadSettings");
+    LoadSettings();
+    TRACE_NEXT(startup, "InitUiCanvas");
+    InitUiCanvas();
 
+    TRACE_NEXT(startup, "CreateWindow");
     const wchar_t CLASS_NAME[] = L"CitronXboxWindowClass";
     WNDCLASSW wc = {};
     wc.lpfnWndProc = WindowProc;
@@ -687,22 +5743,81 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
     HWND hwnd = CreateWindowExW(0, CLASS_NAME, L"Citron", WS_POPUP | WS_VISIBLE, 0, 0, 1920, 1080, NULL, NULL, hInstance, NULL);
     if (!hwnd) return 0;
+    g_MainWindow = hwnd;
     ShowWindow(hwnd, SW_MAXIMIZE);
 
-    LoadSettings();
-    ScanGames();
+    TRACE_NEXT(startup, "EnforceMemoryLimit");
+    EnforceMemoryLimit();
+    TRACE_NEXT(startup, "EnsureSystem");
+    EnsureSystem();
+    TRACE_NEXT(startup, "LoadFirmwareManifest");
+    LoadFirmwareManifest();
+    TRACE_NEXT(startup, "StartWarmup");
+    StartWarmup();
+    if (g_Benchmark.active) {
+        g_PerfSampleMs = BENCHMARK_SAMPLE_MS;
+        g_PerfCapacity = (size_t)g_Benchmark.durationSec * 1000 / BENCHMARK_SAMPLE_MS + 16;
+        Game game;
+        game.path = g_Benchmark.title;
+        game.name = g_Benchmark.title.stem().wstring();
+        StartGame(hwnd, game);
+    } else {
+        TRACE_NEXT(startup, "LoadMetadataCache");
+        LoadMetadataCache();
+        TRACE_NEXT(startup, "ScanGames");
+        ScanGames();
+        ResumeLastSession(hwnd);
+    }
+    TRACE_NEXT(startup, nullptr);
+
+    // Input is polled on a periodic high-resolution timer while a menu is up and
+    // not at all once a title runs; otherwise the thread sleeps in the wait.
+    HANDLE inputTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!inputTimer) inputTimer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    LONG armedPeriod = -1;
+    ULONGLONG nextPoll = 0; // only used when no timer could be created
 
     MSG msg = {};
-    while (true) {
-        if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-            if (msg.message == WM_QUIT) break;
-            TranslateMessage(&msg); DispatchMessage(&msg);
+    bool quit = false;
+    while (!quit) {
+        LONG period = GetInputPollPeriodMs();
+        if (period != armedPeriod) {
+            if (!inputTimer) {
+                nextPoll = 0;
+            } else if (period > 0) {
+                LARGE_INTEGER due;
+                due.QuadPart = -10000LL * period;
+                SetWaitableTimer(inputTimer, &due, period, NULL, NULL, FALSE);
+            } else {
+                CancelWaitableTimer(inputTimer);
+            }
+            armedPeriod = period;
+        }
+
+        bool poll;
+        if (inputTimer) {
+            poll = MsgWaitForMultipleObjectsEx(1, &inputTimer, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE) == WAIT_OBJECT_0;
         } else {
-            HandleInput(hwnd);
-            Sleep(16);
+            // No timer: the wait times out when the next poll is due, and a
+            // stream of messages can't starve the poll.
+            ULONGLONG now = GetTickCount64();
+            DWORD wait = period <= 0 ? INFINITE : nextPoll > now ? (DWORD)(nextPoll - now) : 0;
+            MsgWaitForMultipleObjectsEx(0, NULL, wait, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+            now = GetTickCount64();
+            poll = period > 0 && now >= nextPoll;
+            if (poll) nextPoll = now + period;
+        }
+        if (poll) HandleInput(hwnd);
+
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) { quit = true; break; }
+            TranslateMessage(&msg); DispatchMessage(&msg);
         }
     }
+    if (inputTimer) CloseHandle(inputTimer);
+    ReleaseUiCanvas();
     GdiplusShutdown(g_gdiplusToken);
     CoUninitialize();
-    return 0;
+    TRACE_WRITE();
+    return g_Benchmark.exitCode;
 }
\ No newline at end of file